@@ -0,0 +1,144 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tbrekalo/library.h"
+
+namespace tbrekalo {
+
+// Outcome of an AsyncLibrary call, which is queued on the executor before
+// the call returns. Awaiting it suspends the coroutine until the call has
+// run; the coroutine then resumes on the executor thread that ran it, or
+// right away if the call already finished. Each result is consumed once,
+// either by co_await or by get(); a coroutine running on the executor must
+// not call get(), as it may wait for its own thread.
+template <class T>
+class AsyncResult {
+  struct State {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::optional<T> value;
+    std::coroutine_handle<> waiter;
+
+    auto set(T result) -> void {
+      std::coroutine_handle<> waiter;
+      {
+        std::lock_guard lk(mutex);
+        value.emplace(std::move(result));
+        waiter = std::exchange(this->waiter, nullptr);
+      }
+
+      cv.notify_all();
+      if (waiter) {
+        waiter.resume();
+      }
+    }
+  };
+
+  std::shared_ptr<State> state_;
+
+  AsyncResult() : state_(std::make_shared<State>()) {}
+  friend class AsyncLibrary;
+
+ public:
+  AsyncResult(AsyncResult&&) noexcept = default;
+  auto operator=(AsyncResult&&) noexcept -> AsyncResult& = default;
+
+  auto await_ready() const -> bool {
+    std::lock_guard lk(state_->mutex);
+    return state_->value.has_value();
+  }
+
+  // Does not suspend if the call finished since await_ready.
+  auto await_suspend(std::coroutine_handle<> handle) -> bool {
+    std::lock_guard lk(state_->mutex);
+    if (state_->value.has_value()) {
+      return false;
+    }
+
+    state_->waiter = handle;
+    return true;
+  }
+
+  auto await_resume() -> T { return std::move(*state_->value); }
+
+  // Blocks the calling thread until the call has run, for callers outside a
+  // coroutine.
+  auto get() -> T {
+    std::unique_lock lk(state_->mutex);
+    state_->cv.wait(lk, [this] { return state_->value.has_value(); });
+    return std::move(*state_->value);
+  }
+};
+
+struct AsyncOptions {
+  // Executor threads; at least one is started.
+  std::size_t threads = 1;
+};
+
+// Runs Library calls on dedicated I/O threads so the caller never blocks on
+// the database. Calls are queued in order; with one thread they also run in
+// that order, so independent requests can be issued back to back and
+// awaited later. More threads let queries proceed in parallel on the
+// library's read connections, and calls may then complete out of order.
+//
+// Destruction runs every queued call before joining the threads.
+class AsyncLibrary {
+  class Impl;
+
+  std::unique_ptr<Impl> pimpl_;
+
+  auto library() -> Library&;
+  auto post(std::function<void()> job) -> void;
+
+  template <class Fn>
+  auto submit(Fn fn) -> AsyncResult<std::invoke_result_t<Fn, Library&>> {
+    AsyncResult<std::invoke_result_t<Fn, Library&>> result;
+    post([state = result.state_, fn = std::move(fn), &library = library()] {
+      state->set(fn(library));
+    });
+    return result;
+  }
+
+ public:
+  using Error = Library::Error;
+  template <class T>
+  using Result = AsyncResult<std::expected<T, Error>>;
+
+  explicit AsyncLibrary(Library library, AsyncOptions options = {});
+
+  AsyncLibrary(AsyncLibrary const&) = delete;
+  auto operator=(AsyncLibrary const&) -> AsyncLibrary& = delete;
+
+  ~AsyncLibrary();
+
+  auto insert(Book book) -> Result<UUID>;
+  auto insert_many(std::vector<Book> books) -> Result<std::vector<UUID>>;
+  auto erase(UUID uuid) -> Result<void>;
+
+  auto size() -> Result<std::size_t>;
+  auto distinct() -> Result<std::size_t>;
+  auto find(UUID uuid) -> Result<Library::Record>;
+  auto records() -> Result<std::vector<Library::Record>>;
+  auto name_like(std::string pattern) -> Result<std::vector<Library::Record>>;
+  auto author_like(std::string pattern)
+      -> Result<std::vector<Library::Record>>;
+
+  auto acquire_book(UUID uuid) -> Result<void>;
+  auto release_book(UUID uuid) -> Result<void>;
+  auto available_copies(ISBN isbn) -> Result<std::size_t>;
+  auto acquire_any(ISBN isbn) -> Result<UUID>;
+};
+
+}  // namespace tbrekalo
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <string_view>
+
+#include "tbrekalo/library.h"
+
+namespace tbrekalo {
+
+struct ImportOptions {
+  // Parser threads; zero uses std::thread::hardware_concurrency().
+  std::size_t threads = 0;
+  // Volumes committed per write transaction.
+  std::size_t batch_size = 10'000;
+};
+
+struct ImportSummary {
+  std::size_t imported = 0;
+  // Volumes without a title, authors or a valid ISBN, and volumes whose
+  // ISBN is already in the library under another title or authors.
+  std::size_t skipped = 0;
+};
+
+enum class ImportError : char { IO, MALFORMED_JSON, LIBRARY };
+
+// Imports Google Books volumes from a JSON file, either an API response with
+// an "items" array or a bare array of volumes. Each volume contributes one
+// book: its title, its authors joined with ", " and its ISBN-13, falling back
+// to ISBN-10. Volumes are parsed and validated in parallel while a single
+// writer inserts them `batch_size` at a time.
+auto import_json(Library& library, std::string_view path,
+                 ImportOptions options = {})
+    -> std::expected<ImportSummary, ImportError>;
+
+}  // namespace tbrekalo
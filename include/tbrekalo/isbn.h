@@ -1,74 +1,175 @@
 #pragma once
 
 #include <compare>
+#include <cstdint>
 #include <expected>
+#include <span>
 #include <string_view>
 #include <utility>
 
 namespace tbrekalo {
 
+// ISBN-13 packed into an integer. ISBN-10 input is normalised to its ISBN-13
+// form, so both spellings of a book compare equal.
 class ISBN {
-  static inline constexpr int BUFFER_SIZE = 14;
-  static inline constexpr char SENTINEL = '\0';
+  static inline constexpr int DIGITS = 13;
   friend struct std::hash<ISBN>;
+  friend class ISBNString;
 
-  char data_[BUFFER_SIZE];
+  std::uint64_t value_ = 0;
+
+  constexpr explicit ISBN(std::uint64_t value) noexcept : value_(value) {}
+
+  // Every ISBN-13 starts with one of the two Bookland prefixes.
+  static constexpr auto has_bookland_prefix(std::uint64_t value) noexcept
+      -> bool {
+    auto const prefix = value / 10'000'000'000;
+    return prefix == 978 || prefix == 979;
+  }
+
+  static constexpr auto check_digit_13(std::uint64_t first_12) noexcept
+      -> std::uint64_t {
+    std::uint64_t sum = 0;
+    for (int i = 0; i < DIGITS - 1; ++i, first_12 /= 10) {
+      sum += (first_12 % 10) * (i % 2 == 0 ? 3 : 1);
+    }
+
+    return (10 - sum % 10) % 10;
+  }
 
  public:
-  enum class Error : char { INVALID_LENGTH, INVALID_CHAR };
+  enum class Error : char {
+    INVALID_LENGTH,
+    INVALID_CHAR,
+    INVALID_CHECKSUM,
+    // A 13-digit ISBN not starting with 978 or 979.
+    INVALID_PREFIX,
+  };
+
+  constexpr ISBN() noexcept = default;
 
   friend constexpr auto make_isbn(std::string_view) noexcept
       -> std::expected<ISBN, Error>;
+  friend constexpr auto make_isbn(std::uint64_t) noexcept
+      -> std::expected<ISBN, Error>;
+  friend auto make_isbns(std::span<std::string_view const>,
+                         std::span<std::expected<ISBN, Error>>) -> void;
   friend inline constexpr auto operator<=>(ISBN const&, ISBN const&) noexcept
       -> std::strong_ordering = default;
 
-  auto size() const noexcept -> std::size_t { return BUFFER_SIZE; }
-  auto data(this auto&& self) -> decltype(auto) {
-    return std::forward_like<decltype(self)>(self.data_);
-  }
-
-  explicit operator char const*() const noexcept {
-    return static_cast<char const*>(data_);
-  }
-  explicit operator std::string_view() const noexcept {
-    return std::string_view(static_cast<char const*>(data_));
-  }
+  // The 13 digits as a number, e.g. 9780241129623.
+  constexpr auto value() const noexcept -> std::uint64_t { return value_; }
 };
 
+// Validates a 13-digit ISBN, or a 10-digit one whose check digit may be 'X'.
+// Accepts exactly the values make_isbn(std::uint64_t) does, so every stored
+// ISBN reads back.
 inline constexpr auto make_isbn(std::string_view src) noexcept
     -> std::expected<ISBN, ISBN::Error> {
   if (src.length() != 10 && src.length() != 13) {
     return std::unexpected(ISBN::Error::INVALID_LENGTH);
   }
 
-  ISBN dst;
-  std::size_t i = 0;
-  // TODO(tbrekalo): implement ISBN check sum.
-  for (; i < src.length(); ++i) {
-    dst.data_[i] = src[i];
-    if (src[i] < '0' || src[i] > '9') {
+  std::uint64_t value = 0;
+  std::uint64_t weighted_sum = 0;
+  for (std::size_t i = 0; i < src.length(); ++i) {
+    std::uint64_t digit;
+    if (src[i] >= '0' && src[i] <= '9') {
+      digit = src[i] - '0';
+    } else if (src.length() == 10 && i == 9 &&
+               (src[i] == 'X' || src[i] == 'x')) {
+      digit = 10;
+    } else {
       return std::unexpected(ISBN::Error::INVALID_CHAR);
     }
+
+    if (src.length() == 10) {
+      weighted_sum += (10 - i) * digit;
+      if (i < 9) {
+        value = value * 10 + digit;
+      }
+    } else {
+      weighted_sum += (i % 2 == 0 ? 1 : 3) * digit;
+      value = value * 10 + digit;
+    }
   }
 
-  dst.data_[i] = ISBN::SENTINEL;
-  return dst;
+  if (weighted_sum % (src.length() == 10 ? 11 : 10) != 0) {
+    return std::unexpected(ISBN::Error::INVALID_CHECKSUM);
+  }
+
+  if (src.length() == 10) {
+    value += 978'000'000'000;
+    value = value * 10 + ISBN::check_digit_13(value);
+  } else if (!ISBN::has_bookland_prefix(value)) {
+    return std::unexpected(ISBN::Error::INVALID_PREFIX);
+  }
+
+  return ISBN(value);
 }
 
+// Validates the integer form produced by ISBN::value().
+inline constexpr auto make_isbn(std::uint64_t value) noexcept
+    -> std::expected<ISBN, ISBN::Error> {
+  if (value < 1'000'000'000'000 || value > 9'999'999'999'999) {
+    return std::unexpected(ISBN::Error::INVALID_LENGTH);
+  }
+
+  if (ISBN::check_digit_13(value / 10) != value % 10) {
+    return std::unexpected(ISBN::Error::INVALID_CHECKSUM);
+  }
+
+  if (!ISBN::has_bookland_prefix(value)) {
+    return std::unexpected(ISBN::Error::INVALID_PREFIX);
+  }
+
+  return ISBN(value);
+}
+
+// make_isbn(sources[i]) into targets[i] for every source. `targets` must be at
+// least as long as `sources`.
+//
+// Uses AVX2 or SSE4.1 kernels when the CPU supports them.
+auto make_isbns(std::span<std::string_view const> sources,
+                std::span<std::expected<ISBN, ISBN::Error>> targets) -> void;
+
+// The 13 digits of an ISBN as a null-terminated string.
+class ISBNString {
+  static inline constexpr int STRING_LENGTH = ISBN::DIGITS;
+  char data_[STRING_LENGTH + 1];
+
+ public:
+  constexpr explicit ISBNString(ISBN isbn) noexcept : data_{} {
+    auto value = isbn.value();
+    for (int i = STRING_LENGTH - 1; i >= 0; --i, value /= 10) {
+      data_[i] = static_cast<char>('0' + value % 10);
+    }
+  }
+
+  auto size() const noexcept -> std::size_t { return STRING_LENGTH; }
+  auto data(this auto&& self) -> decltype(auto) {
+    return std::forward_like<decltype(self)>(self.data_);
+  }
+
+  explicit operator char const*() const noexcept {
+    return static_cast<char const*>(data_);
+  }
+  constexpr explicit operator std::string_view() const noexcept {
+    return std::string_view(data_, STRING_LENGTH);
+  }
+};
+
 }  // namespace tbrekalo
 
 namespace std {
 
 template <>
 struct hash<tbrekalo::ISBN> {
-  // djb2
+  // Multiplicative mix; the low digits alone vary too little to index a
+  // power-of-two table well.
   constexpr auto operator()(tbrekalo::ISBN isbn) const noexcept -> std::size_t {
-    std::size_t hash = 5381;
-    for (int i = 0; i < tbrekalo::ISBN::BUFFER_SIZE; ++i) {
-      hash = ((hash << 5) + hash) + isbn.data_[i];
-    }
-
-    return hash;
+    auto const mixed = isbn.value_ * 0x9E37'79B9'7F4A'7C15;
+    return static_cast<std::size_t>(mixed ^ (mixed >> 32));
   }
 };
 
@@ -1,7 +1,17 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <expected>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "tbrekalo/book.h"
@@ -11,9 +21,116 @@ namespace tbrekalo {
 
 class Library {
   class Impl;
+  class CursorState;
 
   enum class Error : char { DB_CONNECTION, INVALID_ARGUMENT, UNEXPECTED };
 
+  // When acquired flag changes made through the availability index reach
+  // the database.
+  enum class Durability : char {
+    // Before acquire_book or release_book returns.
+    SYNC,
+    // In batches on a background thread, at the latest shortly after the
+    // call and when the Library is destroyed. Queries may briefly observe
+    // the old flag and a crash can lose the most recent changes. A batch
+    // that fails to commit is retried with backoff; until it is written,
+    // acquire_book and release_book fail with DB_CONNECTION.
+    DEFERRED,
+  };
+
+  // A statement that ran for at least Options::slow_query_threshold.
+  struct SlowQuery {
+    std::string_view sql;
+    std::chrono::nanoseconds elapsed;
+    // EXPLAIN QUERY PLAN of the statement, one step per line, indented by
+    // depth.
+    std::string plan;
+  };
+
+  struct Options {
+    // Switches the database to write-ahead logging so readers do not block
+    // the writer and vice versa.
+    bool wal = false;
+    // Read-only connections serving queries while a single writer connection
+    // handles mutations. Zero shares the writer for reads; ignored for
+    // in-memory databases.
+    std::size_t read_connections = 0;
+    // Generator for the identifiers of inserted records. V7 keeps inserts
+    // near the right edge of the uuid index.
+    UUIDVersion uuid_version = UUIDVersion::V4;
+    // Keeps the acquired flag of every record in memory so acquire_book and
+    // release_book become a compare-and-swap that fails without touching
+    // the database when the book is already in the requested state. Assumes
+    // no other connection changes the flags.
+    bool availability_index = false;
+    Durability durability = Durability::SYNC;
+    // Records kept by find() in an LRU cache; zero disables the cache.
+    std::size_t record_cache_capacity = 0;
+    // Hands insert, insert_many, erase and the acquired flag changes to a
+    // background writer that commits those of concurrent callers together,
+    // one transaction and one sync per batch. Calls still return once their
+    // change is committed; each fails on its own without affecting the rest
+    // of its batch.
+    bool group_commit = false;
+    // Mutations committed per transaction at most.
+    std::size_t group_commit_batch_size = 256;
+    // How long the writer waits for a batch to fill up. Zero commits
+    // whatever queued while the previous batch was being written.
+    std::chrono::microseconds group_commit_latency{0};
+    // Every insert, erase, acquisition and release adds a row to the change
+    // log read by changes(), whether or not anything reads it. The oldest
+    // changes beyond this many are trimmed once 64 more were logged, so
+    // after a commit the log holds at most 63 changes more than this;
+    // consumers further behind miss the trimmed ones. Zero keeps every
+    // change until trim_changes.
+    std::size_t change_log_retention = 1'000'000;
+    // Records calls, returned rows, errors, connection wait and execution
+    // time of every SQL statement, read through metrics(). Disabled, a
+    // statement pays one null check.
+    bool metrics = false;
+    // Statements running at least this long are passed to on_slow_query,
+    // which also turns on metrics. Zero disables the hook.
+    std::chrono::microseconds slow_query_threshold{0};
+    // Runs on the calling thread while the statement's connection is held,
+    // so it must not call back into the Library.
+    std::function<void(SlowQuery const&)> on_slow_query;
+  };
+
+  struct CacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+  };
+
+  // Durations in power-of-two microsecond buckets: bucket 0 counts those
+  // below 1us and bucket i those in [2^(i-1), 2^i) us. The last bucket
+  // also takes everything longer.
+  struct Histogram {
+    static constexpr std::size_t BUCKETS = 32;
+
+    std::array<std::uint64_t, BUCKETS> buckets{};
+    std::uint64_t count = 0;
+    std::chrono::nanoseconds total{0};
+
+    // Upper bound of the bucket holding the q-quantile, q in [0, 1].
+    auto quantile(double q) const -> std::chrono::microseconds;
+  };
+
+  struct StatementMetrics {
+    std::string_view sql;
+    std::uint64_t calls = 0;
+    std::uint64_t rows = 0;
+    std::uint64_t errors = 0;
+    // Time spent waiting for a connection, including queries that open a
+    // cursor; the rows and execution time of cursors are not recorded.
+    Histogram lock_wait;
+    Histogram execute;
+  };
+
+  struct Metrics {
+    // Statements run at least once.
+    std::vector<StatementMetrics> statements;
+  };
+
   struct Record {
     UUID uuid;
     ISBN isbn;
@@ -22,17 +139,140 @@ class Library {
     bool acquired;
   };
 
+  // Non-owning view of a row; name and author point into SQLite's row buffer
+  // and are only valid until the cursor advances.
+  struct RecordView {
+    UUID uuid;
+    ISBN isbn;
+    std::string_view name;
+    std::string_view author;
+    bool acquired;
+  };
+
+  // Sort order of paged queries. Equal names or authors are ordered by ISBN,
+  // and copies of one book by insertion.
+  enum class Order : char { INSERTION, NAME, AUTHOR };
+
+  struct PageQuery {
+    // Records per page; zero is INVALID_ARGUMENT.
+    std::size_t size = 0;
+    // Page::next_token of the previous page, or empty for the first page.
+    std::string token;
+    Order order = Order::INSERTION;
+  };
+
+  struct Page {
+    std::vector<Record> records;
+    // Opaque position after the last record; empty on the last page.
+    std::string next_token;
+  };
+
+  enum class ChangeKind : char { INSERT, ERASE, ACQUIRE, RELEASE };
+
+  // A committed change to a copy. Sequence numbers grow with every change
+  // and are not reused, also after trim_changes.
+  struct Change {
+    std::uint64_t sequence;
+    ChangeKind kind;
+    UUID uuid;
+  };
+
+  struct Subscription {
+    // Passed to unsubscribe.
+    std::uint64_t id;
+    // The last change committed before subscribing; the handler gets every
+    // change after it.
+    std::uint64_t sequence;
+  };
+
+  // How a batch call treats items that fail.
+  enum class Batch : char {
+    // Commits the items that succeed and reports every failure on its own.
+    PER_ITEM,
+    // Commits nothing when any item fails; the call fails with its error.
+    ALL_OR_NOTHING,
+  };
+
+  // Lazily steps a query one row at a time. Until it is exhausted or
+  // destroyed a cursor holds a library connection, and other threads' calls
+  // needing that connection block. Calls on the iterating thread that would
+  // wait for it fail with DB_CONNECTION instead of deadlocking.
+  class Cursor {
+    std::unique_ptr<CursorState> state_;
+
+    explicit Cursor(std::unique_ptr<CursorState>);
+    friend class Library;
+
+   public:
+    class Iterator {
+      Cursor* cursor_ = nullptr;
+
+     public:
+      using value_type = RecordView;
+      using difference_type = std::ptrdiff_t;
+
+      Iterator() = default;
+      explicit Iterator(Cursor* cursor) : cursor_(cursor) {}
+
+      auto operator*() const -> RecordView const&;
+      auto operator++() -> Iterator&;
+      auto operator++(int) -> void { ++*this; }
+
+      auto operator==(std::default_sentinel_t) const -> bool;
+    };
+
+    Cursor(Cursor&&) noexcept;
+    auto operator=(Cursor&&) noexcept -> Cursor&;
+
+    ~Cursor();
+
+    auto begin() -> Iterator { return Iterator(this); }
+    auto end() -> std::default_sentinel_t { return std::default_sentinel; }
+
+    // Set when iteration stopped early because a row could not be read.
+    auto error() const -> std::optional<Error>;
+  };
+
   mutable std::unique_ptr<Impl> pimpl_;
   explicit Library(std::unique_ptr<Impl>);
 
-  auto fetch_records_generic(std::string_view sql) const
-      -> std::expected<std::vector<Record>, Error>;
-  auto acquisition_generic_sql(std::string_view sql) const
+  // Adds a copy of books[i] under the caller's uuids[i] for every i, in one
+  // transaction.
+  auto insert_with(std::span<UUID const> uuids, std::span<Book const> books)
       -> std::expected<void, Error>;
+  // ISBNs with at least one copy, in ascending order.
+  auto isbns() const -> std::expected<std::vector<ISBN>, Error>;
+
+  friend class ShardedLibrary;
 
  public:
   using Error = Error;
+  using Durability = Durability;
+  using Options = Options;
+  using CacheStats = CacheStats;
+  using SlowQuery = SlowQuery;
+  using Histogram = Histogram;
+  using StatementMetrics = StatementMetrics;
+  using Metrics = Metrics;
   using Record = Record;
+  using RecordView = RecordView;
+  using Order = Order;
+  using PageQuery = PageQuery;
+  using Page = Page;
+  using ChangeKind = ChangeKind;
+  using Change = Change;
+  using Subscription = Subscription;
+  using Batch = Batch;
+  using Cursor = Cursor;
+
+  // Called with the changes of a commit, oldest first, on the thread that
+  // committed them; acquired flags under Durability::DEFERRED on the
+  // background writer. It must not modify the Library or subscribe.
+  using ChangeHandler = std::function<void(std::span<Change const>)>;
+  // Outcome of every item of a batch call, in order.
+  using Outcomes = std::vector<std::expected<void, Error>>;
+  // UUID of every inserted book, or why it failed, in order.
+  using Insertions = std::vector<std::expected<UUID, Error>>;
 
   Library(Library const&) = delete;
   auto operator=(Library const&) -> Library& = delete;
@@ -42,26 +282,86 @@ class Library {
 
   ~Library();
 
+  // Adds a copy of the book. The first copy of an ISBN fixes the book's name
+  // and author; a later copy naming them differently is INVALID_ARGUMENT.
   auto insert(Book const&) -> std::expected<UUID, Error>;
+  // All or none; the failing book is logged and its error returned.
+  auto insert_many(std::span<Book const>)
+      -> std::expected<std::vector<UUID>, Error>;
+  // Under Batch::PER_ITEM every book is inserted in a savepoint of its own,
+  // so a failing book is reported in its slot and the rest are committed.
+  auto insert_many(std::span<Book const>, Batch batch)
+      -> std::expected<Insertions, Error>;
   auto erase(UUID) -> std::expected<void, Error>;
 
   auto size() const -> std::expected<std::size_t, Error>;
   auto distinct() const -> std::expected<std::size_t, Error>;
 
+  // INVALID_ARGUMENT when no record has the given UUID.
+  auto find(UUID) const -> std::expected<Record, Error>;
+  auto cache_stats() const -> CacheStats;
+  // Empty unless Options::metrics or Options::on_slow_query is set.
+  auto metrics() const -> Metrics;
+
   auto records() const -> std::expected<std::vector<Record>, Error>;
+  auto scan() const -> std::expected<Cursor, Error>;
 
   auto name_like(std::string_view) -> std::expected<std::vector<Record>, Error>;
   auto author_like(std::string_view)
       -> std::expected<std::vector<Record>, Error>;
+  auto scan_name_like(std::string_view) const -> std::expected<Cursor, Error>;
+  auto scan_author_like(std::string_view) const
+      -> std::expected<Cursor, Error>;
+
+  // One page of the corresponding query. Every page seeks to where the
+  // previous one ended, so it costs the same however deep it is. A token
+  // from another order is INVALID_ARGUMENT.
+  auto records_page(PageQuery const&) const -> std::expected<Page, Error>;
+  auto name_like_page(std::string_view, PageQuery const&) const
+      -> std::expected<Page, Error>;
+  auto author_like_page(std::string_view, PageQuery const&) const
+      -> std::expected<Page, Error>;
+
+  // Change feed of inserts, erases, acquisitions and releases, recorded in
+  // the same transaction as the change itself. Consumers keep the sequence
+  // of the last change they applied and ask for the ones after it, at most
+  // `limit` at a time. The log takes a row per change and keeps the last
+  // Options::change_log_retention of them.
+  auto changes(std::uint64_t sequence, std::size_t limit) const
+      -> std::expected<std::vector<Change>, Error>;
+  // Drops the changes up to and including `sequence`, once every consumer
+  // has applied them.
+  auto trim_changes(std::uint64_t sequence) -> std::expected<void, Error>;
+  // Pushes changes committed through this Library to `handler`; changes
+  // made by other connections to the same file are only seen by changes().
+  auto subscribe(ChangeHandler) -> std::expected<Subscription, Error>;
+  auto unsubscribe(std::uint64_t id) -> void;
 
   auto acquire_book(UUID) -> std::expected<void, Error>;
   auto release_book(UUID) -> std::expected<void, Error>;
 
-  friend auto make_library(std::string_view path)
+  // Batches of the calls above run in one transaction under one lock, with
+  // the statement prepared once. An item fails with INVALID_ARGUMENT when
+  // the copy does not exist or, for acquire and release, already is in the
+  // requested state.
+  auto acquire_books(std::span<UUID const>, Batch batch = Batch::PER_ITEM)
+      -> std::expected<Outcomes, Error>;
+  auto release_books(std::span<UUID const>, Batch batch = Batch::PER_ITEM)
+      -> std::expected<Outcomes, Error>;
+  auto erase_many(std::span<UUID const>, Batch batch = Batch::PER_ITEM)
+      -> std::expected<Outcomes, Error>;
+
+  // Copies of the book that are not acquired.
+  auto available_copies(ISBN) const -> std::expected<std::size_t, Error>;
+  // Acquires any available copy of the book and returns its UUID;
+  // INVALID_ARGUMENT when there is none.
+  auto acquire_any(ISBN) -> std::expected<UUID, Error>;
+
+  friend auto make_library(std::string_view path, Options options)
       -> std::expected<Library, Library::Error>;
 };
 
-auto make_library(std::string_view path)
+auto make_library(std::string_view path, Library::Options options = {})
     -> std::expected<Library, Library::Error>;
 
 }  // namespace tbrekalo
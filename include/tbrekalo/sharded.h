@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "tbrekalo/library.h"
+
+namespace tbrekalo {
+
+// Spreads copies over several Library shards, each its own SQLite file with
+// its own writer, picked by a fixed hash of the copy's UUID that is part of
+// the on-disk format and the same on every host. Calls naming a UUID
+// go to a single shard, so writes to different shards run in parallel.
+// Queries over the whole collection run on every shard at once, the first
+// on the caller's thread and the others on worker threads the library keeps,
+// and merge the results; records are grouped by shard rather than ordered by
+// insertion.
+class ShardedLibrary {
+  class Workers;
+
+  std::vector<Library> shards_;
+  UUIDVersion uuid_version_;
+  std::unique_ptr<Workers> workers_;
+
+  ShardedLibrary(std::vector<Library> shards, UUIDVersion uuid_version);
+
+  auto shard(UUID const&) -> Library&;
+  auto shard(UUID const&) const -> Library const&;
+
+  // fn(i) for every shard i, all at once.
+  template <class Fn>
+  auto fan_out(Fn const& fn) const
+      -> std::vector<std::invoke_result_t<Fn const&, std::size_t>>;
+
+ public:
+  using Error = Library::Error;
+  using Record = Library::Record;
+  using CacheStats = Library::CacheStats;
+
+  // Why insert_many failed, with the copies it committed to other shards
+  // but could not erase again; those stay in the library.
+  struct InsertError {
+    Error error;
+    std::vector<UUID> left_behind;
+  };
+
+  // A moved-from ShardedLibrary has no shards and may only be assigned to
+  // or destroyed.
+  ShardedLibrary(ShardedLibrary&&) noexcept;
+  auto operator=(ShardedLibrary&&) noexcept -> ShardedLibrary&;
+
+  ~ShardedLibrary();
+
+  auto shard_count() const -> std::size_t { return shards_.size(); }
+
+  auto insert(Book const&) -> std::expected<UUID, Error>;
+  // One transaction per shard, so not atomic across shards: should a shard
+  // fail, the copies already committed to the others are erased again, and
+  // readers and change feed consumers may see them come and go. Copies that
+  // cannot be erased are reported in InsertError::left_behind.
+  auto insert_many(std::span<Book const>)
+      -> std::expected<std::vector<UUID>, InsertError>;
+  auto erase(UUID) -> std::expected<void, Error>;
+
+  auto size() const -> std::expected<std::size_t, Error>;
+  // ISBNs with copies on several shards are counted once.
+  auto distinct() const -> std::expected<std::size_t, Error>;
+
+  auto find(UUID) const -> std::expected<Record, Error>;
+  auto cache_stats() const -> CacheStats;
+
+  auto records() const -> std::expected<std::vector<Record>, Error>;
+  auto name_like(std::string_view) -> std::expected<std::vector<Record>, Error>;
+  auto author_like(std::string_view)
+      -> std::expected<std::vector<Record>, Error>;
+
+  auto acquire_book(UUID) -> std::expected<void, Error>;
+  auto release_book(UUID) -> std::expected<void, Error>;
+
+  auto available_copies(ISBN) const -> std::expected<std::size_t, Error>;
+  // Tries the shards in turn, starting from one picked by the ISBN.
+  auto acquire_any(ISBN) -> std::expected<UUID, Error>;
+
+  friend auto make_sharded_library(std::string_view path, std::size_t shards,
+                                   Library::Options options)
+      -> std::expected<ShardedLibrary, Library::Error>;
+};
+
+// Opens `shards` libraries, at least one, at "<path>.0", "<path>.1", ...;
+// every shard is a private in-memory database when `path` is ":memory:" or
+// empty. A set of files must always be reopened with the same shard count,
+// as it decides where each UUID lives. `options` apply to every shard.
+auto make_sharded_library(std::string_view path, std::size_t shards,
+                          Library::Options options = {})
+    -> std::expected<ShardedLibrary, Library::Error>;
+
+}  // namespace tbrekalo
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "tbrekalo/library.h"
+
+namespace tbrekalo {
+
+enum class SnapshotError : char { IO, MALFORMED, LIBRARY };
+
+// Writes every record of `library` to an immutable snapshot file: fixed-width
+// UUID, ISBN and flag columns, names and authors in one deduplicated string
+// heap, a UUID hash index and record orders by name, author and ISBN. The
+// file is written next to `path` and renamed over it once complete.
+auto write_snapshot(Library const& library, std::string_view path)
+    -> std::expected<void, SnapshotError>;
+
+// Read-only library served straight from a memory-mapped snapshot. Opening
+// only checks the header, so startup does not depend on the catalog size,
+// and processes mapping the same file share its pages. Records keep the
+// acquired flags they had when the snapshot was written.
+class SnapshotLibrary {
+  class Impl;
+
+  std::unique_ptr<Impl> pimpl_;
+  explicit SnapshotLibrary(std::unique_ptr<Impl>);
+
+ public:
+  using Error = Library::Error;
+  using Order = Library::Order;
+  using Record = Library::Record;
+  using RecordView = Library::RecordView;
+
+  SnapshotLibrary(SnapshotLibrary&&) noexcept;
+  auto operator=(SnapshotLibrary&&) noexcept -> SnapshotLibrary&;
+
+  ~SnapshotLibrary();
+
+  auto size() const -> std::size_t;
+  auto distinct() const -> std::size_t;
+
+  // The i-th record in insertion order, borrowing name and author from the
+  // mapping; valid while the SnapshotLibrary lives. UNEXPECTED when the
+  // record points outside the file.
+  auto view(std::size_t i) const -> std::expected<RecordView, Error>;
+
+  // INVALID_ARGUMENT when no record has the given UUID.
+  auto find(UUID) const -> std::expected<Record, Error>;
+  auto records(Order order = Order::INSERTION) const
+      -> std::expected<std::vector<Record>, Error>;
+
+  // Case-insensitive for ASCII like Library::name_like, but the pattern is
+  // matched literally, without LIKE wildcards.
+  auto name_like(std::string_view) const
+      -> std::expected<std::vector<Record>, Error>;
+  auto author_like(std::string_view) const
+      -> std::expected<std::vector<Record>, Error>;
+
+  auto available_copies(ISBN) const -> std::expected<std::size_t, Error>;
+
+  friend auto make_snapshot_library(std::string_view path)
+      -> std::expected<SnapshotLibrary, SnapshotError>;
+};
+
+// Maps a file produced by write_snapshot. MALFORMED when it is not a
+// snapshot of this version or its sections do not fit the file.
+auto make_snapshot_library(std::string_view path)
+    -> std::expected<SnapshotLibrary, SnapshotError>;
+
+}  // namespace tbrekalo
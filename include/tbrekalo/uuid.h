@@ -1,6 +1,8 @@
 #pragma once
 
 #include <compare>
+#include <cstdint>
+#include <cstring>
 #include <expected>
 #include <optional>
 #include <span>
@@ -19,7 +21,7 @@ class UUID {
   friend struct std::hash<UUID>;
 
  public:
-  using SourceSpan = std::span<unsigned char, SIZE>;
+  using SourceSpan = std::span<unsigned char const, SIZE>;
   using TargetSpan = std::span<char, TARGET_SIZE>;
 
   UUID();
@@ -35,19 +37,33 @@ class UUID {
       -> std::strong_ordering = default;
 };
 
+enum class UUIDVersion : char { V4, V7 };
+
+// RFC 9562 version 7: a big-endian millisecond Unix timestamp followed by a
+// counter and random bits. Identifiers made by one process compare in
+// creation order, so consecutive inserts land next to each other in an index.
+auto make_uuid_v7() -> UUID;
+
+// UUID{} for V4, make_uuid_v7() for V7.
+auto make_uuid(UUIDVersion version) -> UUID;
+
 }  // namespace tbrekalo
 
 namespace std {
 
 template <>
 struct hash<tbrekalo::UUID> {
-  // djb2
+  // The two 64-bit halves multiplied into 128 bits and folded back. The bytes
+  // are mostly random already, so one multiplication spreads them enough.
   auto operator()(tbrekalo::UUID uuid) const noexcept -> std::size_t {
-    std::size_t hash = 5381;
-    for (int i = 0; i < tbrekalo::UUID::SIZE; ++i) {
-      hash = ((hash << 5) + hash) + uuid.data_[i];
-    }
-    return hash;
+    std::uint64_t lo, hi;
+    std::memcpy(&lo, uuid.data_, sizeof(lo));
+    std::memcpy(&hi, uuid.data_ + sizeof(lo), sizeof(hi));
+
+    auto const product =
+        static_cast<unsigned __int128>(lo ^ 0x9E37'79B9'7F4A'7C15) *
+        (hi ^ 0xD6E8'FEB8'6659'FD93);
+    return static_cast<std::size_t>(product ^ (product >> 64));
   }
 };
 
@@ -83,22 +99,68 @@ class UUIDString {
       -> std::strong_ordering = default;
 };
 
+// Checks the 8-4-4-4-12 layout and that every other character is a hex digit.
 auto make_uuid_string(std::string_view) -> std::optional<UUIDString>;
 
+// Parses sources[i] into targets[i] and returns how many leading strings were
+// well-formed; parsing stops at the first malformed one. `targets` must be at
+// least as long as `sources`.
+//
+// Uses AVX2 or SSE4.1 kernels when the CPU supports them.
+auto parse_uuids(std::span<std::string_view const> sources,
+                 std::span<UUID> targets) -> std::size_t;
+
+// Writes the lowercase 36-character form of every UUID back to back, without
+// terminators. `target` must hold 36 characters per UUID.
+auto serialize_uuids(std::span<UUID const> uuids, std::span<char> target)
+    -> void;
+
 }  // namespace tbrekalo
 
 namespace std {
 
 template <>
 struct hash<tbrekalo::UUIDString> {
-  // djb2
-  auto operator()(tbrekalo::UUIDString uuid) const noexcept -> std::size_t {
-    std::size_t hash = 5381;
-    for (int i = 0; i < tbrekalo::UUIDString::STRING_LENGTH; ++i) {
-      hash = ((hash << 5) + hash) + uuid.data_[i];
-    }
-    return hash;
+  // Hashes the parsed UUID, so a UUIDString and its UUID hash alike and
+  // either can look up the other through tbrekalo::UUIDHash.
+  auto operator()(tbrekalo::UUIDString const& uuid) const noexcept
+      -> std::size_t {
+    return hash<tbrekalo::UUID>{}(static_cast<tbrekalo::UUID>(uuid));
   }
 };
 
 }  // namespace std
+
+namespace tbrekalo {
+
+// Transparent hash and equality for unordered containers keyed by UUID, so
+// they can be searched with a UUIDString without converting it first:
+//
+//   std::unordered_map<UUID, Record, UUIDHash, UUIDEqual> records;
+//   records.find(*make_uuid_string("d99d53e1-b67c-438b-8420-63766d8f50d0"));
+struct UUIDHash {
+  using is_transparent = void;
+
+  auto operator()(UUID const& uuid) const noexcept -> std::size_t {
+    return std::hash<UUID>{}(uuid);
+  }
+  auto operator()(UUIDString const& uuid) const noexcept -> std::size_t {
+    return std::hash<UUIDString>{}(uuid);
+  }
+};
+
+struct UUIDEqual {
+  using is_transparent = void;
+
+  auto operator()(UUID const& lhs, UUID const& rhs) const noexcept -> bool {
+    return lhs == rhs;
+  }
+  auto operator()(UUID const& lhs, UUIDString const& rhs) const -> bool {
+    return lhs == static_cast<UUID>(rhs);
+  }
+  auto operator()(UUIDString const& lhs, UUID const& rhs) const -> bool {
+    return static_cast<UUID>(lhs) == rhs;
+  }
+};
+
+}  // namespace tbrekalo
@@ -0,0 +1,144 @@
+#include "tbrekalo/async.h"
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+namespace tbrekalo {
+
+class AsyncLibrary::Impl {
+  Library library_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> jobs_;
+  bool stopping_ = false;
+  // Declared last so they start after, and are joined before, the members
+  // they use are destroyed.
+  std::vector<std::jthread> threads_;
+
+  auto run() -> void {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock lk(mutex_);
+        cv_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+
+      job();
+    }
+  }
+
+ public:
+  Impl(Library library, std::size_t threads) : library_(std::move(library)) {
+    for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i) {
+      threads_.emplace_back([this] { run(); });
+    }
+  }
+
+  // Threads keep taking jobs until the queue is empty.
+  ~Impl() {
+    {
+      std::lock_guard lk(mutex_);
+      stopping_ = true;
+    }
+
+    cv_.notify_all();
+    threads_.clear();
+  }
+
+  auto library() -> Library& { return library_; }
+
+  auto post(std::function<void()> job) -> void {
+    {
+      std::lock_guard lk(mutex_);
+      jobs_.push_back(std::move(job));
+    }
+
+    cv_.notify_one();
+  }
+};
+
+AsyncLibrary::AsyncLibrary(Library library, AsyncOptions options)
+    : pimpl_(std::make_unique<Impl>(std::move(library), options.threads)) {}
+
+AsyncLibrary::~AsyncLibrary() {}
+
+auto AsyncLibrary::library() -> Library& { return pimpl_->library(); }
+
+auto AsyncLibrary::post(std::function<void()> job) -> void {
+  pimpl_->post(std::move(job));
+}
+
+auto AsyncLibrary::insert(Book book) -> Result<UUID> {
+  return submit([book = std::move(book)](Library& library) {
+    return library.insert(book);
+  });
+}
+
+auto AsyncLibrary::insert_many(std::vector<Book> books)
+    -> Result<std::vector<UUID>> {
+  return submit([books = std::move(books)](Library& library) {
+    return library.insert_many(books);
+  });
+}
+
+auto AsyncLibrary::erase(UUID uuid) -> Result<void> {
+  return submit([uuid](Library& library) { return library.erase(uuid); });
+}
+
+auto AsyncLibrary::size() -> Result<std::size_t> {
+  return submit([](Library& library) { return library.size(); });
+}
+
+auto AsyncLibrary::distinct() -> Result<std::size_t> {
+  return submit([](Library& library) { return library.distinct(); });
+}
+
+auto AsyncLibrary::find(UUID uuid) -> Result<Library::Record> {
+  return submit([uuid](Library& library) { return library.find(uuid); });
+}
+
+auto AsyncLibrary::records() -> Result<std::vector<Library::Record>> {
+  return submit([](Library& library) { return library.records(); });
+}
+
+auto AsyncLibrary::name_like(std::string pattern)
+    -> Result<std::vector<Library::Record>> {
+  return submit([pattern = std::move(pattern)](Library& library) {
+    return library.name_like(pattern);
+  });
+}
+
+auto AsyncLibrary::author_like(std::string pattern)
+    -> Result<std::vector<Library::Record>> {
+  return submit([pattern = std::move(pattern)](Library& library) {
+    return library.author_like(pattern);
+  });
+}
+
+auto AsyncLibrary::acquire_book(UUID uuid) -> Result<void> {
+  return submit(
+      [uuid](Library& library) { return library.acquire_book(uuid); });
+}
+
+auto AsyncLibrary::release_book(UUID uuid) -> Result<void> {
+  return submit(
+      [uuid](Library& library) { return library.release_book(uuid); });
+}
+
+auto AsyncLibrary::available_copies(ISBN isbn) -> Result<std::size_t> {
+  return submit(
+      [isbn](Library& library) { return library.available_copies(isbn); });
+}
+
+auto AsyncLibrary::acquire_any(ISBN isbn) -> Result<UUID> {
+  return submit([isbn](Library& library) { return library.acquire_any(isbn); });
+}
+
+}  // namespace tbrekalo
@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <ranges>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <uuid/uuid.h>
+
+#include "tbrekalo/library.h"
+#include "tool_util.h"
+
+namespace tb = tbrekalo;
+
+namespace {
+
+using tb::tool::fail;
+using tb::tool::make_isbn_digits;
+using tb::tool::TempDatabase;
+
+struct Options {
+  // Iterations of every micro benchmark.
+  std::size_t micro_ops = 1'000'000;
+  // Iterations of every library benchmark.
+  std::size_t library_ops = 1'000;
+  // Records present in the library before each library benchmark runs.
+  std::vector<std::size_t> sizes = {1'000, 100'000};
+  // Only benchmarks whose name contains this string run.
+  std::string filter;
+  bool json = false;
+};
+
+struct Result {
+  std::string name;
+  std::size_t ops;
+  double seconds;
+};
+
+// Keeps the compiler from discarding a value computed in a timed loop.
+template <class T>
+auto do_not_optimize(T const& value) -> void {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+// A measured quantity other than time, such as a collision rate.
+struct Metric {
+  std::string name;
+  double value;
+};
+
+class Bench {
+  Options const& options_;
+  std::vector<Result> results_;
+  std::vector<Metric> metrics_;
+
+ public:
+  explicit Bench(Options const& options) : options_(options) {}
+
+  auto enabled(std::string_view name) const -> bool {
+    return name.contains(options_.filter);
+  }
+
+  // Times `ops` operations as ops / batch calls of fn(i), each performing
+  // `batch` of them, for i in [0, ops / batch).
+  template <class Fn>
+  auto run(std::string name, std::size_t ops, Fn&& fn, std::size_t batch = 1)
+      -> void {
+    ops -= ops % batch;
+    if (!enabled(name) || ops == 0) {
+      return;
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < ops / batch; ++i) {
+      fn(i);
+    }
+
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    results_.push_back(Result{
+        .name = std::move(name),
+        .ops = ops,
+        .seconds = std::chrono::duration<double>(elapsed).count(),
+    });
+
+    if (!options_.json) {
+      auto const& result = results_.back();
+      std::cout << std::format(
+          "{:<44} {:>10} ops {:>12.1f} ns/op {:>14.0f} ops/s\n", result.name,
+          result.ops, 1e9 * result.seconds / result.ops,
+          result.ops / result.seconds);
+    }
+  }
+
+  auto report(std::string name, double value) -> void {
+    if (!enabled(name)) {
+      return;
+    }
+
+    if (!options_.json) {
+      std::cout << std::format("{:<44} {:>10.4f}\n", name, value);
+    }
+    metrics_.push_back(Metric{.name = std::move(name), .value = value});
+  }
+
+  // One JSON document with every result, for tracking across commits.
+  auto print_json(std::ostream& os) const -> void {
+    os << "{\"benchmarks\": [";
+    for (std::size_t i = 0; i < results_.size(); ++i) {
+      auto const& result = results_[i];
+      os << std::format(
+          "{}\n  {{\"name\": \"{}\", \"ops\": {}, \"seconds\": {:.6f}, "
+          "\"ns_per_op\": {:.3f}, \"ops_per_second\": {:.3f}}}",
+          i == 0 ? "" : ",", result.name, result.ops, result.seconds,
+          1e9 * result.seconds / result.ops, result.ops / result.seconds);
+    }
+    os << "\n], \"metrics\": [";
+    for (std::size_t i = 0; i < metrics_.size(); ++i) {
+      os << std::format("{}\n  {{\"name\": \"{}\", \"value\": {:.6f}}}",
+                        i == 0 ? "" : ",", metrics_[i].name,
+                        metrics_[i].value);
+    }
+    os << "\n]}\n";
+  }
+};
+
+auto make_book(std::size_t index) -> tb::Book {
+  return tb::Book{
+      .isbn = *tb::make_isbn(make_isbn_digits(index)),
+      .name = std::format("Title {}", index),
+      .author = std::format("Author {}", index % 1'000),
+  };
+}
+
+auto make_books(std::size_t first, std::size_t n) -> std::vector<tb::Book> {
+  std::vector<tb::Book> books;
+  books.reserve(n);
+  for (std::size_t i = first; i < first + n; ++i) {
+    books.push_back(make_book(i));
+  }
+  return books;
+}
+
+// The hash std::hash used for ISBN, UUID and UUIDString before, kept as a
+// baseline.
+auto djb2(std::span<char const> bytes) -> std::size_t {
+  std::size_t hash = 5381;
+  for (auto byte : bytes) {
+    hash = ((hash << 5) + hash) + static_cast<unsigned char>(byte);
+  }
+  return hash;
+}
+
+template <class T>
+auto djb2_bytes(T const& value) -> std::size_t {
+  return djb2(std::span(reinterpret_cast<char const*>(value.data()),
+                        value.size()));
+}
+
+// Inputs are cycled through a small pool so the loop measures the operation
+// rather than cache misses on its arguments.
+static constexpr std::size_t POOL_SIZE = 1'024;
+
+auto bench_isbn(Bench& bench, Options const& options) -> void {
+  std::vector<std::string> digits;
+  std::vector<tb::ISBN> isbns;
+  for (std::size_t i = 0; i < POOL_SIZE; ++i) {
+    digits.push_back(make_isbn_digits(i));
+    isbns.push_back(*tb::make_isbn(digits.back()));
+  }
+
+  bench.run("isbn/make_isbn", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(tb::make_isbn(digits[i % POOL_SIZE]));
+  });
+
+  std::vector<std::string_view> views(digits.begin(), digits.end());
+  std::vector<std::expected<tb::ISBN, tb::ISBN::Error>> batch(POOL_SIZE);
+  bench.run(
+      "isbn/make_isbns", options.micro_ops,
+      [&](std::size_t) {
+        tb::make_isbns(views, batch);
+        do_not_optimize(batch);
+      },
+      POOL_SIZE);
+
+  std::vector<tb::ISBNString> isbn_strings;
+  for (auto const& isbn : isbns) {
+    isbn_strings.emplace_back(isbn);
+  }
+
+  bench.run("isbn/hash_djb2", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(djb2_bytes(isbn_strings[i % POOL_SIZE]));
+  });
+
+  bench.run("isbn/hash", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(std::hash<tb::ISBN>{}(isbns[i % POOL_SIZE]));
+  });
+}
+
+auto bench_uuid(Bench& bench, Options const& options) -> void {
+  std::vector<tb::UUID> uuids(POOL_SIZE);
+  std::vector<tb::UUIDString> strings;
+  for (auto const& uuid : uuids) {
+    strings.emplace_back(uuid);
+  }
+
+  bench.run("uuid/generate_v4", options.micro_ops, [](std::size_t) {
+    do_not_optimize(tb::make_uuid(tb::UUIDVersion::V4));
+  });
+
+  bench.run("uuid/generate_v7", options.micro_ops, [](std::size_t) {
+    do_not_optimize(tb::make_uuid(tb::UUIDVersion::V7));
+  });
+
+  // uuid_unparse and uuid_parse are the paths the kernels replaced.
+  bench.run("uuid/serialize_libuuid", options.micro_ops, [&](std::size_t i) {
+    char str[37];
+    uuid_unparse(uuids[i % POOL_SIZE].data(), str);
+    do_not_optimize(str);
+  });
+
+  bench.run("uuid/serialize", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(tb::UUIDString(uuids[i % POOL_SIZE]));
+  });
+
+  std::string serialized(36 * POOL_SIZE, '\0');
+  bench.run(
+      "uuid/serialize_uuids", options.micro_ops,
+      [&](std::size_t) {
+        tb::serialize_uuids(uuids, serialized);
+        do_not_optimize(serialized);
+      },
+      POOL_SIZE);
+
+  bench.run("uuid/parse_libuuid", options.micro_ops, [&](std::size_t i) {
+    uuid_t uuid;
+    uuid_parse(static_cast<char const*>(strings[i % POOL_SIZE]), uuid);
+    do_not_optimize(uuid);
+  });
+
+  bench.run("uuid/parse", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(static_cast<tb::UUID>(strings[i % POOL_SIZE]));
+  });
+
+  std::vector<std::string_view> views;
+  for (auto const& str : strings) {
+    views.emplace_back(str);
+  }
+  auto parsed = uuids;
+  bench.run(
+      "uuid/parse_uuids", options.micro_ops,
+      [&](std::size_t) {
+        if (tb::parse_uuids(views, parsed) != POOL_SIZE) {
+          fail("parse_uuids failed");
+        }
+        do_not_optimize(parsed);
+      },
+      POOL_SIZE);
+
+  bench.run("uuid/hash_djb2", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(djb2_bytes(uuids[i % POOL_SIZE]));
+  });
+
+  bench.run("uuid/hash", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(std::hash<tb::UUID>{}(uuids[i % POOL_SIZE]));
+  });
+
+  bench.run("uuid_string/hash_djb2", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(djb2_bytes(strings[i % POOL_SIZE]));
+  });
+
+  bench.run("uuid_string/hash", options.micro_ops, [&](std::size_t i) {
+    do_not_optimize(std::hash<tb::UUIDString>{}(strings[i % POOL_SIZE]));
+  });
+}
+
+// Fraction of keys landing in an already occupied bucket of a power-of-two
+// table with one bucket per key, indexed by the low bits of the hash. A
+// uniformly random hash gives about 1/e, 0.368.
+template <class Key, class Hash>
+auto collision_rate(std::span<Key const> keys, Hash hash) -> double {
+  auto const buckets = std::bit_ceil(keys.size());
+  std::vector<bool> occupied(buckets);
+  std::size_t collisions = 0;
+  for (auto const& key : keys) {
+    auto&& bucket = occupied[hash(key) & (buckets - 1)];
+    collisions += bucket;
+    bucket = true;
+  }
+  return static_cast<double>(collisions) / keys.size();
+}
+
+auto bench_hash_collisions(Bench& bench) -> void {
+  static constexpr std::size_t KEYS = 1 << 16;
+
+  std::vector<tb::UUID> v4(KEYS);
+  std::vector<tb::UUID> v7;
+  std::vector<tb::UUIDString> v7_strings;
+  std::vector<tb::ISBN> isbns;
+  std::vector<tb::ISBNString> isbn_strings;
+  for (std::size_t i = 0; i < KEYS; ++i) {
+    v7.push_back(tb::make_uuid_v7());
+    v7_strings.emplace_back(v7.back());
+    isbns.push_back(*tb::make_isbn(make_isbn_digits(i)));
+    isbn_strings.emplace_back(isbns.back());
+  }
+
+  auto const djb2_hash = [](auto const& key) { return djb2_bytes(key); };
+  auto const report = [&](std::string_view keys, auto const& values,
+                          auto const& strings) {
+    using Key = std::ranges::range_value_t<decltype(values)>;
+    bench.report(std::format("hash/collisions/{}/djb2", keys),
+                 collision_rate(std::span(strings), djb2_hash));
+    bench.report(std::format("hash/collisions/{}/std_hash", keys),
+                 collision_rate(std::span(values), std::hash<Key>{}));
+  };
+
+  report("uuid_v4", v4, v4);
+  report("uuid_v7", v7, v7);
+  report("uuid_string_v7", v7_strings, v7_strings);
+  report("isbn_sequential", isbns, isbn_strings);
+}
+
+// Fills a library with `size` books and measures single-record operations
+// against it. `backend` is "memory" or "disk"; on-disk libraries use WAL.
+auto bench_library(Bench& bench, Options const& options,
+                   std::string_view backend, std::size_t size) -> void {
+  static constexpr std::size_t BATCH_SIZE = 1'000;
+  static constexpr std::size_t RECORDS_ROWS = 1'000'000;
+
+  auto name = [&](std::string_view op) {
+    return std::format("library/{}/{}/{}", op, backend, size);
+  };
+
+  static constexpr std::string_view OPS[] = {"insert", "records", "name_like",
+                                             "acquire_book"};
+  if (std::ranges::none_of(
+          OPS, [&](std::string_view op) { return bench.enabled(name(op)); })) {
+    return;
+  }
+
+  TempDatabase db("bench");
+  auto const on_disk = backend == "disk";
+  auto library = tb::make_library(on_disk ? std::string_view(db.path)
+                                          : std::string_view(":memory:"),
+                                  {.wal = on_disk});
+  if (!library.has_value()) {
+    fail(std::format("failed to open {} library", backend));
+  }
+
+  std::vector<tb::UUID> uuids;
+  uuids.reserve(size);
+  for (std::size_t i = 0; i < size; i += BATCH_SIZE) {
+    auto batch = library->insert_many(
+        make_books(i, std::min(BATCH_SIZE, size - i)));
+    if (!batch.has_value()) {
+      fail("failed to populate library");
+    }
+    uuids.insert(uuids.end(), batch->begin(), batch->end());
+  }
+
+  std::mt19937_64 rng(size);
+  std::uniform_int_distribution<std::size_t> pick(0, size - 1);
+  std::vector<std::string> patterns;
+  for (std::size_t i = 0; i < options.library_ops; ++i) {
+    patterns.push_back(std::format("Title {}", pick(rng)));
+  }
+
+  bench.run(name("records"), std::max<std::size_t>(1, RECORDS_ROWS / size),
+            [&](std::size_t) { do_not_optimize(library->records()); });
+
+  bench.run(name("name_like"), options.library_ops, [&](std::size_t i) {
+    do_not_optimize(library->name_like(patterns[i]));
+  });
+
+  bench.run(name("acquire_book"), std::min(options.library_ops, size),
+            [&](std::size_t i) {
+              if (!library->acquire_book(uuids[i]).has_value()) {
+                fail("acquire_book failed");
+              }
+            });
+
+  auto const extra = make_books(size, options.library_ops);
+  bench.run(name("insert"), extra.size(), [&](std::size_t i) {
+    if (!library->insert(extra[i]).has_value()) {
+      fail("insert failed");
+    }
+  });
+}
+
+// Inserts `size` books in fixed-size batches into a fresh on-disk library
+// using identifiers of the given version.
+auto bench_insert_many(Bench& bench, tb::UUIDVersion version,
+                       std::string_view version_name, std::size_t size)
+    -> void {
+  static constexpr std::size_t BATCH_SIZE = 1'000;
+
+  auto const name =
+      std::format("library/insert_many/{}/disk/{}", version_name, size);
+  if (!bench.enabled(name)) {
+    return;
+  }
+
+  TempDatabase db("bench");
+  auto library =
+      tb::make_library(db.path, {.wal = true, .uuid_version = version});
+  if (!library.has_value()) {
+    fail(std::format("failed to open {}", db.path));
+  }
+
+  // Ops count records, as for the other benchmarks, not batches.
+  auto const batch_size = std::max<std::size_t>(std::min(BATCH_SIZE, size), 1);
+  auto const books = make_books(0, size);
+  bench.run(
+      name, size,
+      [&](std::size_t i) {
+        auto const batch =
+            std::span(books).subspan(i * batch_size, batch_size);
+        if (!library->insert_many(batch).has_value()) {
+          fail("insert_many failed");
+        }
+      },
+      batch_size);
+}
+
+auto parse_sizes(std::string_view list) -> std::vector<std::size_t> {
+  std::vector<std::size_t> sizes;
+  for (std::size_t begin = 0; begin <= list.size();) {
+    auto const end = std::min(list.find(',', begin), list.size());
+    sizes.push_back(std::stoull(std::string(list.substr(begin, end - begin))));
+    begin = end + 1;
+  }
+  return sizes;
+}
+
+auto parse_options(int argc, char** argv) -> Options {
+  Options options;
+  for (std::string_view arg : std::span(argv, argc).subspan(1)) {
+    auto const value = arg.substr(std::min(arg.find('='), arg.size() - 1) + 1);
+    if (arg == "--json") {
+      options.json = true;
+    } else if (arg.starts_with("--filter=")) {
+      options.filter = value;
+    } else if (arg.starts_with("--sizes=")) {
+      options.sizes = parse_sizes(value);
+    } else if (arg.starts_with("--micro-ops=")) {
+      options.micro_ops = std::stoull(std::string(value));
+    } else if (arg.starts_with("--library-ops=")) {
+      options.library_ops = std::stoull(std::string(value));
+    } else {
+      fail(std::format(
+          "usage: {} [--json] [--filter=SUBSTRING] [--sizes=N,...] "
+          "[--micro-ops=N] [--library-ops=N]",
+          argv[0]));
+    }
+  }
+
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto const options = parse_options(argc, argv);
+  Bench bench(options);
+
+  bench_isbn(bench, options);
+  bench_uuid(bench, options);
+  bench_hash_collisions(bench);
+  for (auto size : options.sizes) {
+    if (size == 0) {
+      continue;
+    }
+
+    for (auto backend : {"memory", "disk"}) {
+      bench_library(bench, options, backend, size);
+    }
+
+    bench_insert_many(bench, tb::UUIDVersion::V4, "uuid_v4", size);
+    bench_insert_many(bench, tb::UUIDVersion::V7, "uuid_v7", size);
+  }
+
+  if (options.json) {
+    bench.print_json(std::cout);
+  }
+
+  return EXIT_SUCCESS;
+}
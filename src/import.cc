@@ -0,0 +1,480 @@
+#include "tbrekalo/import.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <optional>
+#include <semaphore>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace tbrekalo {
+
+// Minimal pull parser over a JSON document. Callers read exactly the values
+// they care about and skip the rest; every method returns false on
+// malformed input.
+class JsonCursor {
+  std::string_view src_;
+  std::size_t pos_ = 0;
+
+  auto skip_whitespace() -> void {
+    while (pos_ < src_.size() && (src_[pos_] == ' ' || src_[pos_] == '\n' ||
+                                  src_[pos_] == '\r' || src_[pos_] == '\t')) {
+      ++pos_;
+    }
+  }
+
+  auto read_hex4(std::uint32_t& value) -> bool {
+    if (src_.size() - pos_ < 4) {
+      return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+      auto const c = src_[pos_++];
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        value |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        value |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static auto append_utf8(std::string& out, std::uint32_t code_point) -> void {
+    if (code_point < 0x80) {
+      out.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  }
+
+  auto read_escape(std::string& out) -> bool {
+    if (pos_ == src_.size()) {
+      return false;
+    }
+
+    switch (src_[pos_++]) {
+      case '"':
+        out.push_back('"');
+        return true;
+      case '\\':
+        out.push_back('\\');
+        return true;
+      case '/':
+        out.push_back('/');
+        return true;
+      case 'b':
+        out.push_back('\b');
+        return true;
+      case 'f':
+        out.push_back('\f');
+        return true;
+      case 'n':
+        out.push_back('\n');
+        return true;
+      case 'r':
+        out.push_back('\r');
+        return true;
+      case 't':
+        out.push_back('\t');
+        return true;
+      case 'u': {
+        std::uint32_t code_point;
+        if (!read_hex4(code_point)) {
+          return false;
+        }
+
+        if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+          std::uint32_t low;
+          if (!src_.substr(pos_).starts_with("\\u")) {
+            return false;
+          }
+
+          pos_ += 2;
+          if (!read_hex4(low) || low < 0xDC00 || low > 0xDFFF) {
+            return false;
+          }
+
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        append_utf8(out, code_point);
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  auto skip_string() -> bool {
+    if (!consume('"')) {
+      return false;
+    }
+
+    while (pos_ < src_.size()) {
+      pos_ = src_.find_first_of("\"\\", pos_);
+      if (pos_ == std::string_view::npos) {
+        break;
+      }
+
+      if (src_[pos_++] == '"') {
+        return true;
+      }
+
+      ++pos_;
+    }
+
+    pos_ = src_.size();
+    return false;
+  }
+
+  auto skip_literal() -> bool {
+    auto const begin = pos_;
+    while (pos_ < src_.size() && src_[pos_] != ',' && src_[pos_] != '}' &&
+           src_[pos_] != ']' && src_[pos_] != ' ' && src_[pos_] != '\n' &&
+           src_[pos_] != '\r' && src_[pos_] != '\t') {
+      ++pos_;
+    }
+
+    return pos_ != begin;
+  }
+
+ public:
+  explicit JsonCursor(std::string_view src) : src_(src) {}
+
+  auto offset() -> std::size_t {
+    skip_whitespace();
+    return pos_;
+  }
+
+  auto peek() -> char {
+    skip_whitespace();
+    return pos_ < src_.size() ? src_[pos_] : '\0';
+  }
+
+  auto at_end() -> bool {
+    skip_whitespace();
+    return pos_ == src_.size();
+  }
+
+  auto consume(char c) -> bool {
+    if (peek() != c) {
+      return false;
+    }
+
+    ++pos_;
+    return true;
+  }
+
+  auto read_string(std::string& out) -> bool {
+    out.clear();
+    if (!consume('"')) {
+      return false;
+    }
+
+    while (pos_ < src_.size()) {
+      auto const special = src_.find_first_of("\"\\", pos_);
+      if (special == std::string_view::npos) {
+        break;
+      }
+
+      out.append(src_.substr(pos_, special - pos_));
+      pos_ = special + 1;
+      if (src_[special] == '"') {
+        return true;
+      }
+
+      if (!read_escape(out)) {
+        return false;
+      }
+    }
+
+    pos_ = src_.size();
+    return false;
+  }
+
+  // Calls fn(key) for each member; fn must consume the member's value.
+  template <class Fn>
+  auto read_object(Fn&& fn) -> bool {
+    if (!consume('{')) {
+      return false;
+    }
+
+    if (consume('}')) {
+      return true;
+    }
+
+    std::string key;
+    do {
+      if (!read_string(key) || !consume(':') || !fn(std::string_view(key))) {
+        return false;
+      }
+    } while (consume(','));
+
+    return consume('}');
+  }
+
+  // Calls fn() for each element; fn must consume the element.
+  template <class Fn>
+  auto read_array(Fn&& fn) -> bool {
+    if (!consume('[')) {
+      return false;
+    }
+
+    if (consume(']')) {
+      return true;
+    }
+
+    do {
+      if (!fn()) {
+        return false;
+      }
+    } while (consume(','));
+
+    return consume(']');
+  }
+
+  auto skip_value() -> bool {
+    switch (peek()) {
+      case '{':
+        return read_object([this](std::string_view) { return skip_value(); });
+      case '[':
+        return read_array([this] { return skip_value(); });
+      case '"':
+        return skip_string();
+      case '\0':
+        return false;
+      default:
+        return skip_literal();
+    }
+  }
+};
+
+// Raw text of every volume in the document, or nullopt if it is malformed.
+static auto split_volumes(std::string_view json)
+    -> std::optional<std::vector<std::string_view>> {
+  JsonCursor cursor(json);
+  std::vector<std::string_view> volumes;
+  auto collect = [&] {
+    auto const begin = cursor.offset();
+    if (!cursor.skip_value()) {
+      return false;
+    }
+
+    volumes.push_back(json.substr(begin, cursor.offset() - begin));
+    return true;
+  };
+
+  auto const parsed =
+      cursor.peek() == '['
+          ? cursor.read_array(collect)
+          : cursor.read_object([&](std::string_view key) {
+              return key == "items" ? cursor.read_array(collect)
+                                    : cursor.skip_value();
+            });
+
+  if (!parsed || !cursor.at_end()) {
+    return std::nullopt;
+  }
+
+  return volumes;
+}
+
+// Book described by a volume, or nullopt when the volume is malformed or
+// lacks a title, authors or a valid ISBN. Fields are read from
+// "volumeInfo" when present and from the volume itself otherwise.
+static auto parse_volume(std::string_view volume) -> std::optional<Book> {
+  JsonCursor cursor(volume);
+  std::string title, isbn, isbn_10, isbn_13;
+  std::vector<std::string> authors;
+
+  auto read_identifier = [&] {
+    std::string type, identifier;
+    auto const parsed = cursor.read_object([&](std::string_view key) {
+      if (key == "type") {
+        return cursor.read_string(type);
+      }
+      if (key == "identifier") {
+        return cursor.read_string(identifier);
+      }
+      return cursor.skip_value();
+    });
+
+    if (type == "ISBN_13") {
+      isbn_13 = std::move(identifier);
+    } else if (type == "ISBN_10") {
+      isbn_10 = std::move(identifier);
+    }
+
+    return parsed;
+  };
+
+  auto read_info = [&](std::string_view key) {
+    if (key == "title") {
+      return cursor.read_string(title);
+    }
+    if (key == "authors") {
+      return cursor.read_array(
+          [&] { return cursor.read_string(authors.emplace_back()); });
+    }
+    if (key == "isbn") {
+      return cursor.read_string(isbn);
+    }
+    if (key == "industryIdentifiers") {
+      return cursor.read_array(read_identifier);
+    }
+    return cursor.skip_value();
+  };
+
+  if (!cursor.read_object([&](std::string_view key) {
+        return key == "volumeInfo" ? cursor.read_object(read_info)
+                                   : read_info(key);
+      })) {
+    return std::nullopt;
+  }
+
+  std::erase(authors, std::string());
+  if (title.empty() || authors.empty()) {
+    return std::nullopt;
+  }
+
+  auto const& identifier =
+      !isbn_13.empty() ? isbn_13 : (!isbn_10.empty() ? isbn_10 : isbn);
+  auto opt_isbn = make_isbn(identifier);
+  if (!opt_isbn.has_value()) {
+    return std::nullopt;
+  }
+
+  std::string author = std::move(authors.front());
+  for (auto const& other : std::span(authors).subspan(1)) {
+    author.append(", ").append(other);
+  }
+
+  return Book{
+      .isbn = *opt_isbn,
+      .name = std::move(title),
+      .author = std::move(author),
+  };
+}
+
+auto import_json(Library& library, std::string_view path,
+                 ImportOptions options)
+    -> std::expected<ImportSummary, ImportError> {
+  auto file = MappedFile::open(path, MADV_SEQUENTIAL);
+  if (!file.has_value()) {
+    return std::unexpected(ImportError::IO);
+  }
+
+  auto volumes = split_volumes(file->view());
+  if (!volumes.has_value()) {
+    return std::unexpected(ImportError::MALFORMED_JSON);
+  }
+
+  auto const batch_size = std::max<std::size_t>(options.batch_size, 1);
+  auto const n_batches = (volumes->size() + batch_size - 1) / batch_size;
+  auto const n_threads = std::clamp<std::size_t>(
+      options.threads != 0 ? options.threads
+                           : std::thread::hardware_concurrency(),
+      1, std::max<std::size_t>(n_batches, 1));
+
+  auto batch_of = [&](std::size_t batch) {
+    auto const begin = batch * batch_size;
+    return std::span(*volumes).subspan(
+        begin, std::min(batch_size, volumes->size() - begin));
+  };
+
+  std::vector<std::promise<std::vector<Book>>> parsed(n_batches);
+  std::vector<std::future<std::vector<Book>>> pending;
+  pending.reserve(n_batches);
+  for (auto& promise : parsed) {
+    pending.push_back(promise.get_future());
+  }
+
+  // Bounds how far parsers may run ahead of the writer.
+  std::counting_semaphore<> window(static_cast<std::ptrdiff_t>(2 * n_threads));
+  std::atomic<std::size_t> next_batch = 0;
+  std::atomic<bool> cancelled = false;
+
+  ImportSummary summary;
+  std::optional<ImportError> error;
+  {
+    std::vector<std::jthread> parsers;
+    for (std::size_t i = 0; i < n_threads; ++i) {
+      parsers.emplace_back([&] {
+        for (;;) {
+          window.acquire();
+          auto const batch = next_batch.fetch_add(1);
+          if (batch >= n_batches || cancelled) {
+            window.release();
+            return;
+          }
+
+          std::vector<Book> books;
+          for (auto volume : batch_of(batch)) {
+            if (auto book = parse_volume(volume); book.has_value()) {
+              books.push_back(*std::move(book));
+            }
+          }
+
+          parsed[batch].set_value(std::move(books));
+        }
+      });
+    }
+
+    for (std::size_t batch = 0; batch < n_batches; ++batch) {
+      auto books = pending[batch].get();
+      window.release();
+
+      summary.skipped += batch_of(batch).size() - books.size();
+      auto inserted = library.insert_many(books, Library::Batch::PER_ITEM);
+      auto const failed =
+          !inserted.has_value() ||
+          std::ranges::any_of(*inserted, [](auto const& outcome) {
+            return !outcome.has_value() &&
+                   outcome.error() != Library::Error::INVALID_ARGUMENT;
+          });
+      if (failed) {
+        error = ImportError::LIBRARY;
+        cancelled = true;
+        window.release(static_cast<std::ptrdiff_t>(n_threads));
+        break;
+      }
+
+      auto const conflicting = static_cast<std::size_t>(std::ranges::count_if(
+          *inserted, [](auto const& outcome) { return !outcome.has_value(); }));
+      summary.skipped += conflicting;
+      summary.imported += books.size() - conflicting;
+    }
+  }
+
+  if (error.has_value()) {
+    return std::unexpected(*error);
+  }
+
+  return summary;
+}
+
+}  // namespace tbrekalo
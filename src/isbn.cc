@@ -1 +1,224 @@
 #include "tbrekalo/isbn.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace tbrekalo {
+
+#if defined(__x86_64__)
+
+// An ISBN right-aligned behind '0' padding, so both lengths share one layout
+// and the padding adds nothing to sums or to the value. An 'X' check digit is
+// replaced by '0' and accounted for separately.
+struct PaddedISBN {
+  static constexpr std::size_t SIZE = 16;
+
+  alignas(SIZE) char chars[SIZE];
+  bool isbn_10;
+  bool x_check;
+};
+
+// What the kernels compute from a PaddedISBN.
+struct DigitSum {
+  bool digits;
+  // The 16 characters read as a number.
+  std::uint64_t value;
+  std::uint32_t weighted_sum;
+};
+
+using Weights = std::array<std::int8_t, PaddedISBN::SIZE>;
+
+// Checksum weights by position; an ISBN-13 starts at position 3, an ISBN-10
+// at position 6.
+static constexpr Weights WEIGHTS_13 = {3, 1, 3, 1, 3, 1, 3, 1,
+                                       3, 1, 3, 1, 3, 1, 3, 1};
+static constexpr Weights WEIGHTS_10 = {0, 0, 0, 0, 0, 0, 10, 9,
+                                       8, 7, 6, 5, 4,  3, 2, 1};
+
+static auto has_isbn_length(std::string_view source) -> bool {
+  return source.size() == 10 || source.size() == 13;
+}
+
+static auto pad(std::string_view source) -> PaddedISBN {
+  PaddedISBN padded{.isbn_10 = source.size() == 10};
+  std::memset(padded.chars, '0', PaddedISBN::SIZE);
+  std::memcpy(padded.chars + PaddedISBN::SIZE - source.size(), source.data(),
+              source.size());
+
+  auto& check = padded.chars[PaddedISBN::SIZE - 1];
+  padded.x_check = padded.isbn_10 && (check == 'X' || check == 'x');
+  if (padded.x_check) {
+    check = '0';
+  }
+  return padded;
+}
+
+static auto weights(PaddedISBN const& padded) -> Weights const& {
+  return padded.isbn_10 ? WEIGHTS_10 : WEIGHTS_13;
+}
+
+[[gnu::target("sse4.1")]] static auto load(void const* src) -> __m128i {
+  return _mm_loadu_si128(static_cast<__m128i const*>(src));
+}
+
+// Lane 0 from `lo`, lane 1 from `hi`.
+[[gnu::target("avx2")]] static auto load(void const* lo, void const* hi)
+    -> __m256i {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(load(lo)), load(hi),
+                                 1);
+}
+
+[[gnu::target("sse4.1")]] static auto sum_digits_sse4(PaddedISBN const& padded)
+    -> DigitSum {
+  auto const digits = _mm_sub_epi8(load(padded.chars), _mm_set1_epi8('0'));
+  auto const is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+  if (_mm_movemask_epi8(is_digit) != 0xFFFF) {
+    return DigitSum{.digits = false};
+  }
+
+  // Weighted products summed pairwise, then across the register.
+  auto sums = _mm_madd_epi16(
+      _mm_maddubs_epi16(digits, load(weights(padded).data())),
+      _mm_set1_epi16(1));
+  sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+  sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  // Digits combined into numbers of two, four and then eight digits.
+  auto const pairs = _mm_maddubs_epi16(digits, _mm_set1_epi16(0x010A));
+  auto const quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x0001'0064));
+  auto const octets = _mm_madd_epi16(_mm_packus_epi32(quads, quads),
+                                     _mm_set1_epi32(0x0001'2710));
+
+  return DigitSum{
+      .digits = true,
+      .value = static_cast<std::uint64_t>(_mm_cvtsi128_si32(octets)) *
+                   100'000'000 +
+               static_cast<std::uint32_t>(_mm_extract_epi32(octets, 1)),
+      .weighted_sum = static_cast<std::uint32_t>(_mm_cvtsi128_si32(sums)),
+  };
+}
+
+// sum_digits_sse4 for two ISBNs at once, one per lane.
+[[gnu::target("avx2")]] static auto sum_digits_pair_avx2(
+    PaddedISBN const& a, PaddedISBN const& b) -> std::array<DigitSum, 2> {
+  auto const digits =
+      _mm256_sub_epi8(load(a.chars, b.chars), _mm256_set1_epi8('0'));
+  auto const is_digit =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(digits, _mm256_set1_epi8(9)), digits);
+  auto const digit_mask =
+      static_cast<std::uint32_t>(_mm256_movemask_epi8(is_digit));
+
+  auto sums = _mm256_madd_epi16(
+      _mm256_maddubs_epi16(digits,
+                           load(weights(a).data(), weights(b).data())),
+      _mm256_set1_epi16(1));
+  sums = _mm256_add_epi32(sums,
+                          _mm256_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+  sums = _mm256_add_epi32(sums,
+                          _mm256_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  auto const pairs = _mm256_maddubs_epi16(digits, _mm256_set1_epi16(0x010A));
+  auto const quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x0001'0064));
+  auto const octets = _mm256_madd_epi16(_mm256_packus_epi32(quads, quads),
+                                        _mm256_set1_epi32(0x0001'2710));
+
+  alignas(32) std::array<std::uint32_t, 8> octet_values, sum_values;
+  _mm256_store_si256(reinterpret_cast<__m256i*>(octet_values.data()), octets);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(sum_values.data()), sums);
+
+  auto const lane = [&](std::size_t index) {
+    return DigitSum{
+        .digits = ((digit_mask >> (16 * index)) & 0xFFFF) == 0xFFFF,
+        .value = std::uint64_t{octet_values[4 * index]} * 100'000'000 +
+                 octet_values[4 * index + 1],
+        .weighted_sum = sum_values[4 * index],
+    };
+  };
+  return {lane(0), lane(1)};
+}
+
+#endif
+
+enum class Kernel : char { SCALAR, SSE4, AVX2 };
+
+// Widest kernel the CPU supports, detected on first use.
+static auto kernel() -> Kernel {
+  static Kernel const detected = [] {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return Kernel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return Kernel::SSE4;
+    }
+#endif
+    return Kernel::SCALAR;
+  }();
+  return detected;
+}
+
+auto make_isbns(std::span<std::string_view const> sources,
+                std::span<std::expected<ISBN, ISBN::Error>> targets) -> void {
+  assert(targets.size() >= sources.size());
+  if (kernel() == Kernel::SCALAR) {
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+      targets[i] = make_isbn(sources[i]);
+    }
+    return;
+  }
+
+#if defined(__x86_64__)
+  auto const finish = [](PaddedISBN const& padded, DigitSum const& sum)
+      -> std::expected<ISBN, ISBN::Error> {
+    if (!sum.digits) {
+      return std::unexpected(ISBN::Error::INVALID_CHAR);
+    }
+
+    if (!padded.isbn_10) {
+      if (sum.weighted_sum % 10 != 0) {
+        return std::unexpected(ISBN::Error::INVALID_CHECKSUM);
+      }
+      if (!ISBN::has_bookland_prefix(sum.value)) {
+        return std::unexpected(ISBN::Error::INVALID_PREFIX);
+      }
+      return ISBN(sum.value);
+    }
+
+    if ((sum.weighted_sum + (padded.x_check ? 10 : 0)) % 11 != 0) {
+      return std::unexpected(ISBN::Error::INVALID_CHECKSUM);
+    }
+    auto const first_12 = 978'000'000'000 + sum.value / 10;
+    return ISBN(first_12 * 10 + ISBN::check_digit_13(first_12));
+  };
+
+  for (std::size_t i = 0; i < sources.size();) {
+    if (!has_isbn_length(sources[i])) {
+      targets[i++] = std::unexpected(ISBN::Error::INVALID_LENGTH);
+      continue;
+    }
+
+    auto const a = pad(sources[i]);
+    if (kernel() == Kernel::AVX2 && i + 1 < sources.size() &&
+        has_isbn_length(sources[i + 1])) {
+      auto const b = pad(sources[i + 1]);
+      auto const [sum_a, sum_b] = sum_digits_pair_avx2(a, b);
+      targets[i] = finish(a, sum_a);
+      targets[i + 1] = finish(b, sum_b);
+      i += 2;
+    } else {
+      targets[i] = finish(a, sum_digits_sse4(a));
+      i += 1;
+    }
+  }
+#endif
+}
+
+}  // namespace tbrekalo
@@ -2,15 +2,37 @@
 
 #include <sqlite3.h>
 
-#include <cassert>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
-#include <cstdio>
+#include <cstdint>
+#include <deque>
 #include <format>
+#include <functional>
+#include <future>
+#include <initializer_list>
 #include <iostream>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <source_location>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <variant>
+#include <vector>
 
 namespace tbrekalo::meta {
 
@@ -26,7 +48,10 @@ static constexpr struct {
 
 namespace tbrekalo::sql {
 
-static constexpr auto INIT_DB_SQL = R"(
+// Schema migrations, applied in order inside one transaction. PRAGMA
+// user_version records how many of them a database has already seen.
+static constexpr auto MIGRATIONS = std::to_array<std::string_view>({
+    R"(
   CREATE TABLE IF NOT EXISTS record(
     uuid TEXT PRIMARY KEY,
     isbn TEXT NOT NULL,
@@ -38,169 +63,2681 @@ static constexpr auto INIT_DB_SQL = R"(
   CREATE INDEX IF NOT EXISTS idx_record_name ON record(name);
   CREATE INDEX IF NOT EXISTS idx_record_author ON record(author);
   CREATE INDEX IF NOT EXISTS idx_record_uuid_acquired ON record(uuid, acquired);
+)",
+    // Trigram full-text index over name and author backing substring search.
+    // The record table gets an explicit INTEGER PRIMARY KEY first, because
+    // VACUUM may renumber implicit rowids and desync the external content.
+    R"(
+  CREATE TABLE record_v1(
+    id INTEGER PRIMARY KEY,
+    uuid TEXT NOT NULL UNIQUE,
+    isbn TEXT NOT NULL,
+    name TEXT NOT NULL,
+    author TEXT NOT NULL,
+    acquired INTEGER DEFAULT 0
+  );
+
+  INSERT INTO record_v1(uuid, isbn, name, author, acquired)
+    SELECT uuid, isbn, name, author, acquired FROM record;
+  DROP TABLE record;
+  ALTER TABLE record_v1 RENAME TO record;
+
+  CREATE INDEX idx_record_name ON record(name);
+  CREATE INDEX idx_record_author ON record(author);
+  CREATE INDEX idx_record_uuid_acquired ON record(uuid, acquired);
+
+  CREATE VIRTUAL TABLE record_fts USING fts5(
+    name, author, content='record', content_rowid='id', tokenize='trigram'
+  );
+
+  CREATE TRIGGER record_fts_insert AFTER INSERT ON record BEGIN
+    INSERT INTO record_fts(rowid, name, author)
+      VALUES (new.id, new.name, new.author);
+  END;
+
+  CREATE TRIGGER record_fts_delete AFTER DELETE ON record BEGIN
+    INSERT INTO record_fts(record_fts, rowid, name, author)
+      VALUES ('delete', old.id, old.name, old.author);
+  END;
+
+  CREATE TRIGGER record_fts_update AFTER UPDATE OF name, author ON record
+  BEGIN
+    INSERT INTO record_fts(record_fts, rowid, name, author)
+      VALUES ('delete', old.id, old.name, old.author);
+    INSERT INTO record_fts(rowid, name, author)
+      VALUES (new.id, new.name, new.author);
+  END;
+
+  INSERT INTO record_fts(record_fts) VALUES ('rebuild');
+)",
+    // Store UUIDs as their 16 raw bytes instead of 36 character strings.
+    // Row ids are kept, so record_fts stays valid without a rebuild.
+    R"(
+  CREATE TABLE record_v2(
+    id INTEGER PRIMARY KEY,
+    uuid BLOB NOT NULL UNIQUE,
+    isbn TEXT NOT NULL,
+    name TEXT NOT NULL,
+    author TEXT NOT NULL,
+    acquired INTEGER DEFAULT 0
+  );
+
+  INSERT INTO record_v2(id, uuid, isbn, name, author, acquired)
+    SELECT id, uuid_to_blob(uuid), isbn, name, author, acquired FROM record;
+  DROP TABLE record;
+  ALTER TABLE record_v2 RENAME TO record;
+
+  CREATE INDEX idx_record_name ON record(name);
+  CREATE INDEX idx_record_author ON record(author);
+  CREATE INDEX idx_record_uuid_acquired ON record(uuid, acquired);
+
+  CREATE TRIGGER record_fts_insert AFTER INSERT ON record BEGIN
+    INSERT INTO record_fts(rowid, name, author)
+      VALUES (new.id, new.name, new.author);
+  END;
+
+  CREATE TRIGGER record_fts_delete AFTER DELETE ON record BEGIN
+    INSERT INTO record_fts(record_fts, rowid, name, author)
+      VALUES ('delete', old.id, old.name, old.author);
+  END;
+
+  CREATE TRIGGER record_fts_update AFTER UPDATE OF name, author ON record
+  BEGIN
+    INSERT INTO record_fts(record_fts, rowid, name, author)
+      VALUES ('delete', old.id, old.name, old.author);
+    INSERT INTO record_fts(rowid, name, author)
+      VALUES (new.id, new.name, new.author);
+  END;
+)",
+    // Record and distinct ISBN counts maintained by triggers, so size() and
+    // distinct() read a single row instead of scanning the table.
+    R"(
+  CREATE TABLE isbn_count(
+    isbn TEXT PRIMARY KEY,
+    copies INTEGER NOT NULL
+  ) WITHOUT ROWID;
+
+  CREATE TABLE record_count(
+    id INTEGER PRIMARY KEY CHECK (id = 0),
+    records INTEGER NOT NULL,
+    isbns INTEGER NOT NULL
+  );
+
+  INSERT INTO isbn_count(isbn, copies)
+    SELECT isbn, COUNT(*) FROM record GROUP BY isbn;
+  INSERT INTO record_count(id, records, isbns)
+    VALUES (0, (SELECT COUNT(*) FROM record),
+            (SELECT COUNT(*) FROM isbn_count));
+
+  CREATE TRIGGER record_count_insert AFTER INSERT ON record BEGIN
+    INSERT INTO isbn_count(isbn, copies) VALUES (new.isbn, 1)
+      ON CONFLICT(isbn) DO UPDATE SET copies = copies + 1;
+    UPDATE record_count SET
+      records = records + 1,
+      isbns = isbns + (SELECT copies = 1 FROM isbn_count WHERE isbn = new.isbn);
+  END;
+
+  CREATE TRIGGER record_count_delete AFTER DELETE ON record BEGIN
+    UPDATE isbn_count SET copies = copies - 1 WHERE isbn = old.isbn;
+    UPDATE record_count SET
+      records = records - 1,
+      isbns = isbns - (SELECT copies = 0 FROM isbn_count WHERE isbn = old.isbn);
+    DELETE FROM isbn_count WHERE isbn = old.isbn AND copies = 0;
+  END;
+
+  CREATE TRIGGER record_count_update AFTER UPDATE OF isbn ON record
+  WHEN old.isbn IS NOT new.isbn BEGIN
+    UPDATE isbn_count SET copies = copies - 1 WHERE isbn = old.isbn;
+    INSERT INTO isbn_count(isbn, copies) VALUES (new.isbn, 1)
+      ON CONFLICT(isbn) DO UPDATE SET copies = copies + 1;
+    UPDATE record_count SET isbns = isbns
+      - (SELECT copies = 0 FROM isbn_count WHERE isbn = old.isbn)
+      + (SELECT copies = 1 FROM isbn_count WHERE isbn = new.isbn);
+    DELETE FROM isbn_count WHERE isbn = old.isbn AND copies = 0;
+  END;
+)",
+    // Split records into a book per ISBN holding name and author and a copy
+    // per UUID. The copies column replaces isbn_count; a book is removed
+    // with its last copy. SQLite takes the bare columns of an aggregate
+    // query from the row picked by MAX(), so every book takes the metadata
+    // of its most recently inserted copy. Copies that had another name or
+    // author keep theirs in copy_conflicting_metadata.
+    R"(
+  CREATE TABLE book(
+    id INTEGER PRIMARY KEY,
+    isbn TEXT NOT NULL UNIQUE,
+    name TEXT NOT NULL,
+    author TEXT NOT NULL,
+    copies INTEGER NOT NULL DEFAULT 0
+  );
+
+  CREATE TABLE copy(
+    id INTEGER PRIMARY KEY,
+    uuid BLOB NOT NULL UNIQUE,
+    isbn TEXT NOT NULL REFERENCES book(isbn),
+    acquired INTEGER NOT NULL DEFAULT 0
+  );
+
+  INSERT INTO book(isbn, name, author, copies)
+    SELECT isbn, name, author, copies FROM (
+      SELECT isbn, name, author, MAX(id), COUNT(*) AS copies
+      FROM record GROUP BY isbn
+    );
+  INSERT INTO copy(id, uuid, isbn, acquired)
+    SELECT id, uuid, isbn, acquired FROM record;
+
+  CREATE TABLE copy_conflicting_metadata(
+    uuid BLOB PRIMARY KEY,
+    name TEXT NOT NULL,
+    author TEXT NOT NULL
+  );
+
+  INSERT INTO copy_conflicting_metadata(uuid, name, author)
+    SELECT record.uuid, record.name, record.author
+    FROM record JOIN book ON book.isbn = record.isbn
+    WHERE record.name IS NOT book.name OR record.author IS NOT book.author;
+
+  DROP TABLE record_fts;
+  DROP TABLE record;
+  DROP TABLE isbn_count;
+
+  CREATE INDEX idx_copy_isbn_acquired ON copy(isbn, acquired);
+
+  CREATE VIRTUAL TABLE book_fts USING fts5(
+    name, author, content='book', content_rowid='id', tokenize='trigram'
+  );
+
+  CREATE TRIGGER book_fts_insert AFTER INSERT ON book BEGIN
+    INSERT INTO book_fts(rowid, name, author)
+      VALUES (new.id, new.name, new.author);
+  END;
+
+  CREATE TRIGGER book_fts_delete AFTER DELETE ON book BEGIN
+    INSERT INTO book_fts(book_fts, rowid, name, author)
+      VALUES ('delete', old.id, old.name, old.author);
+  END;
+
+  CREATE TRIGGER book_fts_update AFTER UPDATE OF name, author ON book BEGIN
+    INSERT INTO book_fts(book_fts, rowid, name, author)
+      VALUES ('delete', old.id, old.name, old.author);
+    INSERT INTO book_fts(rowid, name, author)
+      VALUES (new.id, new.name, new.author);
+  END;
+
+  INSERT INTO book_fts(book_fts) VALUES ('rebuild');
+
+  CREATE TRIGGER copy_insert AFTER INSERT ON copy BEGIN
+    UPDATE book SET copies = copies + 1 WHERE isbn = new.isbn;
+    UPDATE record_count SET
+      records = records + 1,
+      isbns = isbns + (SELECT copies = 1 FROM book WHERE isbn = new.isbn);
+  END;
+
+  CREATE TRIGGER copy_delete AFTER DELETE ON copy BEGIN
+    UPDATE book SET copies = copies - 1 WHERE isbn = old.isbn;
+    UPDATE record_count SET
+      records = records - 1,
+      isbns = isbns - (SELECT copies = 0 FROM book WHERE isbn = old.isbn);
+    DELETE FROM book WHERE isbn = old.isbn AND copies = 0;
+  END;
+)",
+    // Store ISBNs as their ISBN-13 integer. The integer becomes book's rowid,
+    // so book_fts and copy reference it directly. Books whose ISBN-10 and
+    // ISBN-13 spellings were stored separately are merged; copies of the
+    // spelling whose metadata was dropped keep it in
+    // copy_conflicting_metadata. Older schemas did not validate ISBNs;
+    // copies whose ISBN has no integer are moved to copy_invalid_isbn for
+    // the user to repair rather than failing the migration.
+    R"(
+  CREATE TABLE copy_invalid_isbn(
+    uuid BLOB PRIMARY KEY,
+    isbn TEXT NOT NULL,
+    name TEXT NOT NULL,
+    author TEXT NOT NULL,
+    acquired INTEGER NOT NULL
+  );
+
+  INSERT INTO copy_invalid_isbn(uuid, isbn, name, author, acquired)
+    SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired
+    FROM copy JOIN book ON book.isbn = copy.isbn
+    WHERE isbn_to_integer(copy.isbn) IS NULL;
+
+  CREATE TABLE book_v5(
+    isbn INTEGER PRIMARY KEY,
+    name TEXT NOT NULL,
+    author TEXT NOT NULL,
+    copies INTEGER NOT NULL DEFAULT 0
+  );
+
+  CREATE TABLE copy_v5(
+    id INTEGER PRIMARY KEY,
+    uuid BLOB NOT NULL UNIQUE,
+    isbn INTEGER NOT NULL REFERENCES book_v5(isbn),
+    acquired INTEGER NOT NULL DEFAULT 0
+  );
+
+  INSERT INTO book_v5(isbn, name, author, copies)
+    SELECT isbn13, name, author, copies FROM (
+      SELECT isbn_to_integer(isbn) AS isbn13, name, author, MAX(id),
+             SUM(copies) AS copies
+      FROM book WHERE isbn_to_integer(isbn) IS NOT NULL GROUP BY isbn13
+    );
+  INSERT INTO copy_v5(id, uuid, isbn, acquired)
+    SELECT id, uuid, isbn_to_integer(isbn), acquired FROM copy
+    WHERE isbn_to_integer(isbn) IS NOT NULL;
+
+  INSERT OR IGNORE INTO copy_conflicting_metadata(uuid, name, author)
+    SELECT copy.uuid, book.name, book.author
+    FROM copy
+    JOIN book ON book.isbn = copy.isbn
+    JOIN book_v5 ON book_v5.isbn = isbn_to_integer(copy.isbn)
+    WHERE book.name IS NOT book_v5.name OR book.author IS NOT book_v5.author;
+
+  DROP TABLE book_fts;
+  DROP TABLE copy;
+  DROP TABLE book;
+  ALTER TABLE book_v5 RENAME TO book;
+  ALTER TABLE copy_v5 RENAME TO copy;
+
+  UPDATE record_count SET
+    records = (SELECT COUNT(*) FROM copy),
+    isbns = (SELECT COUNT(*) FROM book);
+
+  CREATE INDEX idx_copy_isbn_acquired ON copy(isbn, acquired);
+
+  CREATE VIRTUAL TABLE book_fts USING fts5(
+    name, author, content='book', content_rowid='isbn', tokenize='trigram'
+  );
+
+  CREATE TRIGGER book_fts_insert AFTER INSERT ON book BEGIN
+    INSERT INTO book_fts(rowid, name, author)
+      VALUES (new.isbn, new.name, new.author);
+  END;
+
+  CREATE TRIGGER book_fts_delete AFTER DELETE ON book BEGIN
+    INSERT INTO book_fts(book_fts, rowid, name, author)
+      VALUES ('delete', old.isbn, old.name, old.author);
+  END;
+
+  CREATE TRIGGER book_fts_update AFTER UPDATE OF name, author ON book BEGIN
+    INSERT INTO book_fts(book_fts, rowid, name, author)
+      VALUES ('delete', old.isbn, old.name, old.author);
+    INSERT INTO book_fts(rowid, name, author)
+      VALUES (new.isbn, new.name, new.author);
+  END;
+
+  INSERT INTO book_fts(book_fts) VALUES ('rebuild');
+
+  CREATE TRIGGER copy_insert AFTER INSERT ON copy BEGIN
+    UPDATE book SET copies = copies + 1 WHERE isbn = new.isbn;
+    UPDATE record_count SET
+      records = records + 1,
+      isbns = isbns + (SELECT copies = 1 FROM book WHERE isbn = new.isbn);
+  END;
+
+  CREATE TRIGGER copy_delete AFTER DELETE ON copy BEGIN
+    UPDATE book SET copies = copies - 1 WHERE isbn = old.isbn;
+    UPDATE record_count SET
+      records = records - 1,
+      isbns = isbns - (SELECT copies = 0 FROM book WHERE isbn = old.isbn);
+    DELETE FROM book WHERE isbn = old.isbn AND copies = 0;
+  END;
+)",
+    // Keyset pagination ordered by name or author seeks these indices; the
+    // ISBN rowid they implicitly end with breaks ties between books.
+    R"(
+  CREATE INDEX idx_book_name ON book(name);
+  CREATE INDEX idx_book_author ON book(author);
+)",
+    // Append-only log of copy changes backing the change feed. Kinds follow
+    // Library::ChangeKind: 0 insert, 1 erase, 2 acquire, 3 release.
+    // AUTOINCREMENT keeps sequence numbers from being reused once the log
+    // is trimmed.
+    R"(
+  CREATE TABLE change_log(
+    seq INTEGER PRIMARY KEY AUTOINCREMENT,
+    kind INTEGER NOT NULL,
+    uuid BLOB NOT NULL
+  );
+
+  CREATE TRIGGER change_log_insert AFTER INSERT ON copy BEGIN
+    INSERT INTO change_log(kind, uuid) VALUES (0, new.uuid);
+  END;
+
+  CREATE TRIGGER change_log_delete AFTER DELETE ON copy BEGIN
+    INSERT INTO change_log(kind, uuid) VALUES (1, old.uuid);
+  END;
+
+  CREATE TRIGGER change_log_update AFTER UPDATE OF acquired ON copy
+  WHEN old.acquired IS NOT new.acquired BEGIN
+    INSERT INTO change_log(kind, uuid)
+      VALUES (CASE new.acquired WHEN 0 THEN 3 ELSE 2 END, new.uuid);
+  END;
+)",
+});
+
+static constexpr auto SET_USER_VERSION_FMT = R"(PRAGMA user_version={};)";
+
+static auto make_set_user_version_sql(std::size_t version) -> std::string {
+  return std::format(SET_USER_VERSION_FMT, version);
+}
+
+enum class Statement : char {
+  USER_VERSION,
+  INSERT_BOOK,
+  BOOK_MATCHES,
+  INSERT_COPY,
+  ERASE,
+  COUNT,
+  DISTINCT,
+  ISBNS,
+  RECORDS,
+  NAME_LIKE,
+  AUTHOR_LIKE,
+  RECORDS_PAGE,
+  RECORDS_BY_NAME_PAGE,
+  RECORDS_BY_AUTHOR_PAGE,
+  NAME_LIKE_PAGE,
+  NAME_LIKE_BY_NAME_PAGE,
+  NAME_LIKE_BY_AUTHOR_PAGE,
+  AUTHOR_LIKE_PAGE,
+  AUTHOR_LIKE_BY_NAME_PAGE,
+  AUTHOR_LIKE_BY_AUTHOR_PAGE,
+  ACQUIRE_RECORD,
+  RELEASE_RECORD,
+  AVAILABLE_COPIES,
+  ACQUIRE_ANY,
+  COPIES,
+  FIND,
+  AVAILABILITY,
+  SET_ACQUIRED,
+  CHANGES,
+  LAST_CHANGE,
+  TRIM_CHANGES,
+  RETAIN_CHANGES,
+  BEGIN,
+  COMMIT,
+  ROLLBACK,
+  SAVEPOINT,
+  RELEASE_SAVEPOINT,
+  ROLLBACK_TO_SAVEPOINT,
+};
+
+static constexpr auto STATEMENT_COUNT =
+    static_cast<std::size_t>(Statement::ROLLBACK_TO_SAVEPOINT) + 1;
+
+static constexpr auto USER_VERSION_SQL = R"(PRAGMA user_version;)";
+
+// A book's name and author are those of its first copy; later copies must
+// match them, which BOOK_MATCHES checks when the insert changes nothing.
+static constexpr auto INSERT_BOOK_SQL = R"(
+  INSERT INTO book(isbn, name, author) VALUES(?1, ?2, ?3)
+  ON CONFLICT(isbn) DO NOTHING;
+)";
+
+static constexpr auto BOOK_MATCHES_SQL =
+    R"(SELECT name IS ?2 AND author IS ?3 FROM book WHERE isbn=?1;)";
+
+static constexpr auto INSERT_COPY_SQL =
+    R"(INSERT INTO copy(uuid, isbn, acquired) VALUES(?1, ?2, ?3);)";
+
+static constexpr auto ERASE_SQL = R"(DELETE FROM copy WHERE uuid=?1;)";
+
+static constexpr auto COUNT_SQL = R"(SELECT records FROM record_count;)";
+
+static constexpr auto DISTINCT_SQL = R"(SELECT isbns FROM record_count;)";
+
+static constexpr auto ISBNS_SQL = R"(SELECT isbn FROM book ORDER BY isbn;)";
+
+static constexpr auto RECORDS_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired
+  FROM copy JOIN book ON book.isbn = copy.isbn
+  ORDER BY copy.id;
+)";
+
+// The trigram index narrows candidates; repeating LIKE on the book keeps
+// results identical to a plain scan.
+static constexpr auto NAME_LIKE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.isbn IN (
+    SELECT rowid FROM book_fts WHERE name LIKE '%' || ?1 || '%'
+  ) AND book.name LIKE '%' || ?1 || '%'
+  ORDER BY copy.id;
+)";
+
+static constexpr auto AUTHOR_LIKE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.isbn IN (
+    SELECT rowid FROM book_fts WHERE author LIKE '%' || ?1 || '%'
+  ) AND book.author LIKE '%' || ?1 || '%'
+  ORDER BY copy.id;
+)";
+
+// Pages of records, resumed after the last row of the previous page rather
+// than skipped over with OFFSET. ?1 is the last copy.id, ?2 the row limit,
+// ?3 and ?4 the last name or author and ISBN when ordered by those, and ?5
+// the search pattern. The row-value comparison picks up where the previous
+// page stopped; the plain >= lets it seek the name or author index.
+static constexpr auto RECORDS_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM copy JOIN book ON book.isbn = copy.isbn
+  WHERE copy.id > ?1
+  ORDER BY copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto RECORDS_BY_NAME_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.name >= ?3
+    AND (book.name, book.isbn, copy.id) > (?3, ?4, ?1)
+  ORDER BY book.name, book.isbn, copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto RECORDS_BY_AUTHOR_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.author >= ?3
+    AND (book.author, book.isbn, copy.id) > (?3, ?4, ?1)
+  ORDER BY book.author, book.isbn, copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto NAME_LIKE_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM copy JOIN book ON book.isbn = copy.isbn
+  WHERE copy.id > ?1
+    AND book.isbn IN (
+      SELECT rowid FROM book_fts WHERE name LIKE '%' || ?5 || '%'
+    ) AND book.name LIKE '%' || ?5 || '%'
+  ORDER BY copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto NAME_LIKE_BY_NAME_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.name >= ?3
+    AND (book.name, book.isbn, copy.id) > (?3, ?4, ?1)
+    AND book.isbn IN (
+      SELECT rowid FROM book_fts WHERE name LIKE '%' || ?5 || '%'
+    ) AND book.name LIKE '%' || ?5 || '%'
+  ORDER BY book.name, book.isbn, copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto NAME_LIKE_BY_AUTHOR_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.author >= ?3
+    AND (book.author, book.isbn, copy.id) > (?3, ?4, ?1)
+    AND book.isbn IN (
+      SELECT rowid FROM book_fts WHERE name LIKE '%' || ?5 || '%'
+    ) AND book.name LIKE '%' || ?5 || '%'
+  ORDER BY book.author, book.isbn, copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto AUTHOR_LIKE_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM copy JOIN book ON book.isbn = copy.isbn
+  WHERE copy.id > ?1
+    AND book.isbn IN (
+      SELECT rowid FROM book_fts WHERE author LIKE '%' || ?5 || '%'
+    ) AND book.author LIKE '%' || ?5 || '%'
+  ORDER BY copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto AUTHOR_LIKE_BY_NAME_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.name >= ?3
+    AND (book.name, book.isbn, copy.id) > (?3, ?4, ?1)
+    AND book.isbn IN (
+      SELECT rowid FROM book_fts WHERE author LIKE '%' || ?5 || '%'
+    ) AND book.author LIKE '%' || ?5 || '%'
+  ORDER BY book.name, book.isbn, copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto AUTHOR_LIKE_BY_AUTHOR_PAGE_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired, copy.id
+  FROM book JOIN copy ON copy.isbn = book.isbn
+  WHERE book.author >= ?3
+    AND (book.author, book.isbn, copy.id) > (?3, ?4, ?1)
+    AND book.isbn IN (
+      SELECT rowid FROM book_fts WHERE author LIKE '%' || ?5 || '%'
+    ) AND book.author LIKE '%' || ?5 || '%'
+  ORDER BY book.author, book.isbn, copy.id
+  LIMIT ?2;
+)";
+
+static constexpr auto ACQUIRE_RECORD_SQL =
+    R"(UPDATE copy SET acquired=1 WHERE uuid=?1 AND acquired=0;)";
+
+static constexpr auto RELEASE_RECORD_SQL =
+    R"(UPDATE copy SET acquired=0 WHERE uuid=?1 AND acquired=1;)";
+
+static constexpr auto AVAILABLE_COPIES_SQL =
+    R"(SELECT COUNT(*) FROM copy WHERE isbn=?1 AND acquired=0;)";
+
+static constexpr auto ACQUIRE_ANY_SQL = R"(
+  UPDATE copy SET acquired=1
+  WHERE id=(SELECT id FROM copy WHERE isbn=?1 AND acquired=0 LIMIT 1)
+  RETURNING uuid;
+)";
+
+static constexpr auto COPIES_SQL = R"(SELECT uuid FROM copy WHERE isbn=?1;)";
+
+static constexpr auto FIND_SQL = R"(
+  SELECT copy.uuid, copy.isbn, book.name, book.author, copy.acquired
+  FROM copy JOIN book ON book.isbn = copy.isbn
+  WHERE copy.uuid=?1;
+)";
+
+static constexpr auto AVAILABILITY_SQL = R"(SELECT uuid, acquired FROM copy;)";
+
+static constexpr auto SET_ACQUIRED_SQL =
+    R"(UPDATE copy SET acquired=?2 WHERE uuid=?1;)";
+
+static constexpr auto CHANGES_SQL = R"(
+  SELECT seq, kind, uuid FROM change_log WHERE seq > ?1 ORDER BY seq LIMIT ?2;
+)";
+
+// sqlite_sequence keeps the last sequence number also after trimming.
+static constexpr auto LAST_CHANGE_SQL = R"(
+  SELECT COALESCE(
+    (SELECT seq FROM sqlite_sequence WHERE name = 'change_log'), 0);
+)";
+
+static constexpr auto TRIM_CHANGES_SQL =
+    R"(DELETE FROM change_log WHERE seq <= ?1;)";
+
+// Keeps the last ?1 changes.
+static constexpr auto RETAIN_CHANGES_SQL = R"(
+  DELETE FROM change_log WHERE seq <= (
+    SELECT seq FROM sqlite_sequence WHERE name = 'change_log') - ?1;
 )";
 
-static constexpr auto INSERT_FMT =
-    R"(INSERT INTO record VALUES('{}', '{}', '{}', '{}', '{}'))";
+static constexpr auto WAL_SQL = R"(PRAGMA journal_mode=WAL;)";
+
+static constexpr auto BEGIN_SQL = R"(BEGIN IMMEDIATE;)";
+
+static constexpr auto COMMIT_SQL = R"(COMMIT;)";
+
+static constexpr auto ROLLBACK_SQL = R"(ROLLBACK;)";
+
+static constexpr auto SAVEPOINT_SQL = R"(SAVEPOINT mutation;)";
+
+static constexpr auto RELEASE_SAVEPOINT_SQL = R"(RELEASE mutation;)";
+
+static constexpr auto ROLLBACK_TO_SAVEPOINT_SQL = R"(ROLLBACK TO mutation;)";
+
+static constexpr auto statement_sql(Statement statement) -> std::string_view {
+  switch (statement) {
+    case Statement::USER_VERSION:
+      return USER_VERSION_SQL;
+    case Statement::INSERT_BOOK:
+      return INSERT_BOOK_SQL;
+    case Statement::BOOK_MATCHES:
+      return BOOK_MATCHES_SQL;
+    case Statement::INSERT_COPY:
+      return INSERT_COPY_SQL;
+    case Statement::ERASE:
+      return ERASE_SQL;
+    case Statement::COUNT:
+      return COUNT_SQL;
+    case Statement::DISTINCT:
+      return DISTINCT_SQL;
+    case Statement::ISBNS:
+      return ISBNS_SQL;
+    case Statement::RECORDS:
+      return RECORDS_SQL;
+    case Statement::NAME_LIKE:
+      return NAME_LIKE_SQL;
+    case Statement::AUTHOR_LIKE:
+      return AUTHOR_LIKE_SQL;
+    case Statement::RECORDS_PAGE:
+      return RECORDS_PAGE_SQL;
+    case Statement::RECORDS_BY_NAME_PAGE:
+      return RECORDS_BY_NAME_PAGE_SQL;
+    case Statement::RECORDS_BY_AUTHOR_PAGE:
+      return RECORDS_BY_AUTHOR_PAGE_SQL;
+    case Statement::NAME_LIKE_PAGE:
+      return NAME_LIKE_PAGE_SQL;
+    case Statement::NAME_LIKE_BY_NAME_PAGE:
+      return NAME_LIKE_BY_NAME_PAGE_SQL;
+    case Statement::NAME_LIKE_BY_AUTHOR_PAGE:
+      return NAME_LIKE_BY_AUTHOR_PAGE_SQL;
+    case Statement::AUTHOR_LIKE_PAGE:
+      return AUTHOR_LIKE_PAGE_SQL;
+    case Statement::AUTHOR_LIKE_BY_NAME_PAGE:
+      return AUTHOR_LIKE_BY_NAME_PAGE_SQL;
+    case Statement::AUTHOR_LIKE_BY_AUTHOR_PAGE:
+      return AUTHOR_LIKE_BY_AUTHOR_PAGE_SQL;
+    case Statement::ACQUIRE_RECORD:
+      return ACQUIRE_RECORD_SQL;
+    case Statement::RELEASE_RECORD:
+      return RELEASE_RECORD_SQL;
+    case Statement::AVAILABLE_COPIES:
+      return AVAILABLE_COPIES_SQL;
+    case Statement::ACQUIRE_ANY:
+      return ACQUIRE_ANY_SQL;
+    case Statement::COPIES:
+      return COPIES_SQL;
+    case Statement::FIND:
+      return FIND_SQL;
+    case Statement::AVAILABILITY:
+      return AVAILABILITY_SQL;
+    case Statement::SET_ACQUIRED:
+      return SET_ACQUIRED_SQL;
+    case Statement::CHANGES:
+      return CHANGES_SQL;
+    case Statement::LAST_CHANGE:
+      return LAST_CHANGE_SQL;
+    case Statement::TRIM_CHANGES:
+      return TRIM_CHANGES_SQL;
+    case Statement::RETAIN_CHANGES:
+      return RETAIN_CHANGES_SQL;
+    case Statement::BEGIN:
+      return BEGIN_SQL;
+    case Statement::COMMIT:
+      return COMMIT_SQL;
+    case Statement::ROLLBACK:
+      return ROLLBACK_SQL;
+    case Statement::SAVEPOINT:
+      return SAVEPOINT_SQL;
+    case Statement::RELEASE_SAVEPOINT:
+      return RELEASE_SAVEPOINT_SQL;
+    case Statement::ROLLBACK_TO_SAVEPOINT:
+      return ROLLBACK_TO_SAVEPOINT_SQL;
+  }
+
+  std::unreachable();
+}
+
+// Values bound to the positional parameters (?1, ?2, ...) of a statement.
+// Strings and blobs are bound with SQLITE_STATIC and must outlive the
+// execution.
+using Param = std::variant<std::int64_t, std::string_view,
+                           std::span<unsigned char const>>;
+
+static auto isbn_param(ISBN const& isbn) -> Param {
+  return static_cast<std::int64_t>(isbn.value());
+}
+
+// Binds a UUID as its raw bytes; `uuid` must outlive the execution.
+static auto uuid_param(UUID const& uuid) -> Param {
+  return std::span<unsigned char const>(uuid.data());
+}
+
+}  // namespace tbrekalo::sql
+
+namespace tbrekalo {
+
+static auto column_string_view(sqlite3_stmt* stmt, int column)
+    -> std::string_view {
+  auto const* text =
+      reinterpret_cast<char const*>(sqlite3_column_text(stmt, column));
+  return std::string_view(text, sqlite3_column_bytes(stmt, column));
+}
+
+static auto column_uuid(sqlite3_stmt* stmt, int column)
+    -> std::optional<UUID> {
+  if (static_cast<std::size_t>(sqlite3_column_bytes(stmt, column)) !=
+      UUID::SourceSpan::extent) {
+    return std::nullopt;
+  }
+
+  return UUID(UUID::SourceSpan(
+      static_cast<unsigned char const*>(sqlite3_column_blob(stmt, column)),
+      UUID::SourceSpan::extent));
+}
+
+static auto read_count(void* count, sqlite3_stmt* stmt) -> int {
+  *static_cast<std::size_t*>(count) =
+      static_cast<std::size_t>(sqlite3_column_int64(stmt, 0));
+  return 0;
+}
+
+static auto read_uuid(void* uuids, sqlite3_stmt* stmt) -> int {
+  auto opt_uuid = column_uuid(stmt, 0);
+  if (!opt_uuid.has_value()) {
+    return 1;
+  }
+
+  static_cast<std::vector<UUID>*>(uuids)->push_back(*opt_uuid);
+  return 0;
+}
+
+static auto read_isbn(void* isbns, sqlite3_stmt* stmt) -> int {
+  auto opt_isbn =
+      make_isbn(static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 0)));
+  if (!opt_isbn.has_value()) {
+    return 1;
+  }
+
+  static_cast<std::vector<ISBN>*>(isbns)->push_back(*opt_isbn);
+  return 0;
+}
+
+static auto read_change(void* changes, sqlite3_stmt* stmt) -> int {
+  auto opt_uuid = column_uuid(stmt, 2);
+  auto const kind = sqlite3_column_int(stmt, 1);
+  if (!opt_uuid.has_value() || kind < 0 ||
+      kind > std::to_underlying(Library::ChangeKind::RELEASE)) {
+    return 1;
+  }
+
+  static_cast<std::vector<Library::Change>*>(changes)->push_back(
+      Library::Change{
+          .sequence = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 0)),
+          .kind = static_cast<Library::ChangeKind>(kind),
+          .uuid = *opt_uuid,
+      });
+  return 0;
+}
+
+// Reads a row produced by `SELECT uuid, isbn, name, author, acquired`. The
+// returned view borrows the statement's row buffer.
+static auto read_record_view(sqlite3_stmt* stmt)
+    -> std::optional<Library::RecordView> {
+  auto opt_uuid = column_uuid(stmt, 0);
+  if (!opt_uuid.has_value()) {
+    return std::nullopt;
+  }
+
+  auto opt_isbn =
+      make_isbn(static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 1)));
+  if (!opt_isbn.has_value()) {
+    return std::nullopt;
+  }
+
+  return Library::RecordView{
+      .uuid = *opt_uuid,
+      .isbn = *opt_isbn,
+      .name = column_string_view(stmt, 2),
+      .author = column_string_view(stmt, 3),
+      .acquired = sqlite3_column_int(stmt, 4) != 0,
+  };
+}
+
+static auto read_record(void* records_vec_void_ptr, sqlite3_stmt* stmt)
+    -> int {
+  auto& records =
+      *reinterpret_cast<std::vector<Library::Record>*>(records_vec_void_ptr);
+  auto view = read_record_view(stmt);
+  if (!view.has_value()) {
+    return 1;
+  }
+
+  records.push_back(Library::Record{
+      .uuid = view->uuid,
+      .isbn = view->isbn,
+      .name = std::string(view->name),
+      .author = std::string(view->author),
+      .acquired = view->acquired,
+  });
+  return 0;
+}
+
+// A row of a page query: the record followed by its copy.id.
+struct PageRows {
+  std::vector<Library::Record> records;
+  std::vector<std::int64_t> ids;
+};
+
+static auto read_page_row(void* rows, sqlite3_stmt* stmt) -> int {
+  auto& page = *static_cast<PageRows*>(rows);
+  if (read_record(&page.records, stmt)) {
+    return 1;
+  }
+
+  page.ids.push_back(sqlite3_column_int64(stmt, 5));
+  return 0;
+}
+
+// Where a page ends: the copy.id of its last record and, when ordered by
+// name or author, that record's ISBN and name or author.
+struct PageKey {
+  std::int64_t id = 0;
+  std::int64_t isbn = 0;
+  std::string key;
+};
+
+static constexpr auto order_tag(Library::Order order) -> char {
+  switch (order) {
+    case Library::Order::INSERTION:
+      return 'i';
+    case Library::Order::NAME:
+      return 'n';
+    case Library::Order::AUTHOR:
+      return 'a';
+  }
+
+  std::unreachable();
+}
+
+// "i<id>" in insertion order, otherwise "n<id>:<isbn>:<name>" or
+// "a<id>:<isbn>:<author>"; the key comes last so it may contain ':'.
+static auto encode_page_token(Library::Order order, PageKey const& key)
+    -> std::string {
+  if (order == Library::Order::INSERTION) {
+    return std::format("{}{}", order_tag(order), key.id);
+  }
+
+  return std::format("{}{}:{}:{}", order_tag(order), key.id, key.isbn,
+                     key.key);
+}
+
+static auto decode_page_token(Library::Order order, std::string_view token)
+    -> std::expected<PageKey, Library::Error> {
+  PageKey key;
+  if (token.empty()) {
+    return key;
+  }
+
+  auto const invalid = std::unexpected(Library::Error::INVALID_ARGUMENT);
+  if (token.front() != order_tag(order)) {
+    return invalid;
+  }
+
+  auto const* const end = token.data() + token.size();
+  auto const id = std::from_chars(token.data() + 1, end, key.id);
+  if (id.ec != std::errc{}) {
+    return invalid;
+  }
+
+  if (order == Library::Order::INSERTION) {
+    if (id.ptr != end) {
+      return invalid;
+    }
+
+    return key;
+  }
+
+  if (id.ptr == end || *id.ptr != ':') {
+    return invalid;
+  }
+
+  auto const isbn = std::from_chars(id.ptr + 1, end, key.isbn);
+  if (isbn.ec != std::errc{} || isbn.ptr == end || *isbn.ptr != ':') {
+    return invalid;
+  }
+
+  key.key.assign(isbn.ptr + 1, end);
+  return key;
+}
+
+static auto bind_param(sqlite3_stmt* stmt, int index, sql::Param const& param)
+    -> int {
+  return std::visit(
+      [stmt, index]<class T>(T const& value) -> int {
+        if constexpr (std::is_same_v<T, std::int64_t>) {
+          return sqlite3_bind_int64(stmt, index, value);
+        } else if constexpr (std::is_same_v<T, std::string_view>) {
+          return sqlite3_bind_text(stmt, index, value.data(),
+                                   static_cast<int>(value.size()),
+                                   SQLITE_STATIC);
+        } else {
+          return sqlite3_bind_blob(stmt, index, value.data(),
+                                   static_cast<int>(value.size()),
+                                   SQLITE_STATIC);
+        }
+      },
+      param);
+}
+
+static auto log(std::string_view message, const std::source_location location =
+                                              std::source_location::current()) {
+  /* clang-format off */
+  std::cerr << std::format("file={}:{} function={} message='{}'",
+                           location.file_name(),
+                           location.line(),
+                           location.function_name(),
+                           message) << std::endl;
+  /* clang-format on */
+}
+
+// How long a connection waits on a database locked by another connection
+// before giving up with SQLITE_BUSY.
+static constexpr int BUSY_TIMEOUT_MS = 5000;
+
+using unique_sqlite3 =
+    std::unique_ptr<sqlite3,
+                    decltype([](sqlite3* db) -> void { sqlite3_close(db); })>;
+
+using unique_sqlite3_stmt =
+    std::unique_ptr<sqlite3_stmt, decltype([](sqlite3_stmt* stmt) -> void {
+                      sqlite3_finalize(stmt);
+                    })>;
+
+// Resets a cached statement and drops its bindings once execution is done so
+// it can be reused by the next call.
+using scoped_stmt_reset =
+    std::unique_ptr<sqlite3_stmt, decltype([](sqlite3_stmt* stmt) -> void {
+                      sqlite3_reset(stmt);
+                      sqlite3_clear_bindings(stmt);
+                    })>;
+
+class Library::CursorState {
+  // Declaration order matters: the statement is reset before the pattern it
+  // borrows is freed and before the connection lock is released.
+  std::unique_lock<std::mutex> lock_;
+  // The connection's record of the thread holding it through this cursor.
+  std::atomic<std::thread::id>* holder_;
+  std::string pattern_;
+  scoped_stmt_reset stmt_;
+  RecordView current_;
+  std::optional<Error> error_;
+
+  auto fail(Error error) -> void {
+    error_ = error;
+    finish();
+  }
+
+ public:
+  CursorState(std::unique_lock<std::mutex> lock,
+              std::atomic<std::thread::id>& holder, sqlite3_stmt* stmt,
+              std::string pattern)
+      : lock_(std::move(lock)),
+        holder_(&holder),
+        pattern_(std::move(pattern)),
+        stmt_(stmt) {
+    holder_->store(std::this_thread::get_id());
+  }
+
+  CursorState(CursorState const&) = delete;
+  auto operator=(CursorState const&) -> CursorState& = delete;
+
+  ~CursorState() { finish(); }
+
+  auto bind_pattern() -> bool {
+    return sqlite3_bind_text(stmt_.get(), 1, pattern_.data(),
+                             static_cast<int>(pattern_.size()),
+                             SQLITE_STATIC) == SQLITE_OK;
+  }
+
+  auto advance() -> void {
+    if (done()) {
+      return;
+    }
+
+    switch (sqlite3_step(stmt_.get())) {
+      case SQLITE_ROW:
+        if (auto view = read_record_view(stmt_.get()); view.has_value()) {
+          current_ = *view;
+          return;
+        }
+
+        log("failed to read record");
+        return fail(Error::UNEXPECTED);
+      case SQLITE_DONE:
+        return finish();
+      default:
+        log(sqlite3_errmsg(sqlite3_db_handle(stmt_.get())));
+        return fail(Error::UNEXPECTED);
+    }
+  }
+
+  // Resets the statement and hands the connection back to the library.
+  auto finish() -> void {
+    stmt_.reset();
+    if (lock_.owns_lock()) {
+      holder_->store(std::thread::id());
+      lock_.unlock();
+    }
+  }
+
+  auto done() const -> bool { return stmt_ == nullptr; }
+  auto current() const -> RecordView const& { return current_; }
+  auto error() const -> std::optional<Error> { return error_; }
+};
+
+// Per-statement counters and latency histograms shared by all connections
+// of a library. Updates are relaxed atomics, so a snapshot taken while
+// statements run may be slightly inconsistent across fields.
+class Instrumentation {
+  using Clock = std::chrono::steady_clock;
+
+  struct AtomicHistogram {
+    std::array<std::atomic<std::uint64_t>, Library::Histogram::BUCKETS>
+        buckets{};
+    std::atomic<std::uint64_t> count = 0;
+    std::atomic<std::int64_t> total_ns = 0;
+
+    auto record(std::chrono::nanoseconds elapsed) -> void {
+      auto const us = static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+              .count());
+      auto const bucket = std::min<std::size_t>(
+          std::bit_width(us), Library::Histogram::BUCKETS - 1);
+      buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+      count.fetch_add(1, std::memory_order_relaxed);
+      total_ns.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    }
+
+    auto snapshot() const -> Library::Histogram {
+      Library::Histogram histogram;
+      for (std::size_t i = 0; i < buckets.size(); ++i) {
+        histogram.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+      }
+
+      histogram.count = count.load(std::memory_order_relaxed);
+      histogram.total =
+          std::chrono::nanoseconds(total_ns.load(std::memory_order_relaxed));
+      return histogram;
+    }
+  };
+
+  struct Counters {
+    std::atomic<std::uint64_t> calls = 0;
+    std::atomic<std::uint64_t> rows = 0;
+    std::atomic<std::uint64_t> errors = 0;
+    AtomicHistogram lock_wait;
+    AtomicHistogram execute;
+  };
+
+  std::array<Counters, sql::STATEMENT_COUNT> statements_;
+  std::chrono::nanoseconds slow_query_threshold_;
+  std::function<void(Library::SlowQuery const&)> on_slow_query_;
+
+ public:
+  Instrumentation(std::chrono::nanoseconds slow_query_threshold,
+                  std::function<void(Library::SlowQuery const&)> on_slow_query)
+      : slow_query_threshold_(slow_query_threshold),
+        on_slow_query_(std::move(on_slow_query)) {}
+
+  static auto now() -> Clock::time_point { return Clock::now(); }
+
+  auto record_lock_wait(sql::Statement statement, Clock::time_point start)
+      -> void {
+    statements_[std::to_underlying(statement)].lock_wait.record(now() - start);
+  }
+
+  auto record_execute(sql::Statement statement,
+                      std::chrono::nanoseconds elapsed, std::uint64_t rows,
+                      bool failed) -> void {
+    auto& counters = statements_[std::to_underlying(statement)];
+    counters.calls.fetch_add(1, std::memory_order_relaxed);
+    counters.rows.fetch_add(rows, std::memory_order_relaxed);
+    if (failed) {
+      counters.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    counters.execute.record(elapsed);
+  }
+
+  auto is_slow(std::chrono::nanoseconds elapsed) const -> bool {
+    return on_slow_query_ != nullptr &&
+           slow_query_threshold_ != std::chrono::nanoseconds::zero() &&
+           elapsed >= slow_query_threshold_;
+  }
+
+  auto report_slow(Library::SlowQuery const& query) const -> void {
+    on_slow_query_(query);
+  }
+
+  auto snapshot() const -> Library::Metrics {
+    Library::Metrics metrics;
+    for (std::size_t i = 0; i < statements_.size(); ++i) {
+      auto const& counters = statements_[i];
+      auto lock_wait = counters.lock_wait.snapshot();
+      auto calls = counters.calls.load(std::memory_order_relaxed);
+      if (calls == 0 && lock_wait.count == 0) {
+        continue;
+      }
+
+      metrics.statements.push_back(Library::StatementMetrics{
+          .sql = sql::statement_sql(static_cast<sql::Statement>(i)),
+          .calls = calls,
+          .rows = counters.rows.load(std::memory_order_relaxed),
+          .errors = counters.errors.load(std::memory_order_relaxed),
+          .lock_wait = lock_wait,
+          .execute = counters.execute.snapshot(),
+      });
+    }
+
+    return metrics;
+  }
+};
+
+// A single SQLite connection with its own statement cache. Every use of the
+// connection is serialised by its mutex.
+class Connection {
+  unique_sqlite3 db_;
+  // Declared after db_ so statements are finalized before the connection
+  // is closed.
+  std::array<unique_sqlite3_stmt, sql::STATEMENT_COUNT> statements_;
+  std::mutex mutex_;
+  // Owned by the library; null when metrics are disabled.
+  Instrumentation* instrumentation_ = nullptr;
+  // Thread iterating a cursor that holds the connection, if any.
+  std::atomic<std::thread::id> cursor_thread_;
+
+ public:
+  using Error = Library::Error;
+
+  explicit Connection(unique_sqlite3 db) : db_(std::move(db)) {}
+
+  auto set_instrumentation(Instrumentation* instrumentation) -> void {
+    instrumentation_ = instrumentation;
+  }
+
+  auto lock() -> std::unique_lock<std::mutex> {
+    return std::unique_lock(mutex_);
+  }
+
+  // Same as lock, recording the wait against `statement` when metrics are
+  // enabled.
+  auto lock(sql::Statement statement) -> std::unique_lock<std::mutex> {
+    if (instrumentation_ == nullptr) {
+      return lock();
+    }
+
+    auto const start = Instrumentation::now();
+    auto lk = lock();
+    instrumentation_->record_lock_wait(statement, start);
+    return lk;
+  }
+
+  auto try_lock() -> std::unique_lock<std::mutex> {
+    return std::unique_lock(mutex_, std::try_to_lock);
+  }
+
+  auto cursor_thread() -> std::atomic<std::thread::id>& {
+    return cursor_thread_;
+  }
+
+  // Whether a cursor of the calling thread holds the connection, so locking
+  // it again would deadlock. Only the holding thread ever sees its own id.
+  auto held_by_caller() const -> bool {
+    return cursor_thread_.load(std::memory_order_relaxed) ==
+           std::this_thread::get_id();
+  }
+
+  auto handle() const -> sqlite3* { return db_.get(); }
+
+  // Returns the cached statement, preparing it on first use. Expects the
+  // connection to be locked.
+  auto prepare(sql::Statement statement) -> sqlite3_stmt* {
+    auto& cached = statements_[std::to_underlying(statement)];
+    if (cached == nullptr) {
+      auto const sql = sql::statement_sql(statement);
+      sqlite3_stmt* stmt = nullptr;
+      if (sqlite3_prepare_v3(db_.get(), sql.data(),
+                             static_cast<int>(sql.size()),
+                             SQLITE_PREPARE_PERSISTENT, &stmt, nullptr)) {
+        log(sqlite3_errmsg(db_.get()));
+        return nullptr;
+      }
+
+      cached.reset(stmt);
+    }
+
+    return cached.get();
+  }
+
+  auto execute_script(std::string_view sql) -> std::expected<void, Error> {
+    std::lock_guard lk(mutex_);
+    return execute_script_locked(sql);
+  }
+
+  // Same as execute_script, but expects the connection to already be locked.
+  auto execute_script_locked(std::string_view sql)
+      -> std::expected<void, Error> {
+    char* errmsg;
+    if (db_.get() == nullptr) {
+      return std::unexpected(Error::DB_CONNECTION);
+    }
+
+    if (sqlite3_exec(db_.get(),
+                     /* sql = */ sql.data(),
+                     /* callback = */ nullptr,
+                     /* callback_arg = */ nullptr,
+                     /* errmsg = */ &errmsg)) {
+      log(errmsg);
+      sqlite3_free(errmsg);
+      return std::unexpected(Error::UNEXPECTED);
+    }
+
+    return {};
+  }
+
+  struct ExecuteArgs {
+    sql::Statement statement = meta::REQUIRED;
+    std::initializer_list<sql::Param> params = {};
+    int (*callback)(void*, sqlite3_stmt*) = nullptr;
+    void* callback_arg = nullptr;
+  };
+
+  auto execute(ExecuteArgs args) -> std::expected<int, Error> {
+    if (held_by_caller()) {
+      log("connection is held by a cursor of this thread");
+      return std::unexpected(Error::DB_CONNECTION);
+    }
+
+    auto lk = lock(args.statement);
+    return execute_locked(args);
+  }
+
+  // Runs `fn(*this)` inside a single write transaction while holding the
+  // connection lock. `fn` must only use execute_locked and return a
+  // std::expected; the transaction is committed if it holds a value and
+  // rolled back otherwise.
+  template <class Fn>
+  auto transaction(Fn&& fn) -> std::invoke_result_t<Fn, Connection&> {
+    if (held_by_caller()) {
+      log("connection is held by a cursor of this thread");
+      return std::unexpected(Error::DB_CONNECTION);
+    }
+
+    auto lk = lock(sql::Statement::BEGIN);
+    if (auto begin =
+            execute_locked(ExecuteArgs{.statement = sql::Statement::BEGIN});
+        !begin.has_value()) {
+      return std::unexpected(begin.error());
+    }
+
+    auto result = std::invoke(std::forward<Fn>(fn), *this);
+    if (result.has_value()) {
+      if (auto commit = execute_locked(
+              ExecuteArgs{.statement = sql::Statement::COMMIT});
+          !commit.has_value()) {
+        execute_locked(ExecuteArgs{.statement = sql::Statement::ROLLBACK});
+        return std::unexpected(commit.error());
+      }
+    } else {
+      execute_locked(ExecuteArgs{.statement = sql::Statement::ROLLBACK});
+    }
+
+    return result;
+  }
+
+  // Runs `fn(*this)` inside a savepoint, undoing only its changes when it
+  // fails. Expects the connection to be locked inside a transaction.
+  template <class Fn>
+  auto savepoint_locked(Fn&& fn) -> std::invoke_result_t<Fn, Connection&> {
+    if (auto savepoint =
+            execute_locked(ExecuteArgs{.statement = sql::Statement::SAVEPOINT});
+        !savepoint.has_value()) {
+      return std::unexpected(savepoint.error());
+    }
+
+    auto result = std::invoke(std::forward<Fn>(fn), *this);
+    if (!result.has_value()) {
+      execute_locked(
+          ExecuteArgs{.statement = sql::Statement::ROLLBACK_TO_SAVEPOINT});
+    }
+
+    execute_locked(ExecuteArgs{.statement = sql::Statement::RELEASE_SAVEPOINT});
+    return result;
+  }
+
+  // Same as execute, but expects the connection to already be locked.
+  auto execute_locked(ExecuteArgs args) -> std::expected<int, Error> {
+    if (db_.get() == nullptr) {
+      return std::unexpected(Error::DB_CONNECTION);
+    }
+
+    auto* stmt = prepare(args.statement);
+    if (stmt == nullptr) {
+      return std::unexpected(Error::UNEXPECTED);
+    }
+
+    scoped_stmt_reset reset(stmt);
+    int index = 0;
+    for (auto const& param : args.params) {
+      if (bind_param(stmt, ++index, param)) {
+        log(sqlite3_errmsg(db_.get()));
+        return std::unexpected(Error::UNEXPECTED);
+      }
+    }
+
+    std::uint64_t rows = 0;
+    if (instrumentation_ == nullptr) {
+      return step_locked(stmt, args, rows);
+    }
+
+    auto const start = Instrumentation::now();
+    auto result = step_locked(stmt, args, rows);
+    auto const elapsed = Instrumentation::now() - start;
+    instrumentation_->record_execute(args.statement, elapsed, rows,
+                                     !result.has_value());
+    if (instrumentation_->is_slow(elapsed)) {
+      auto const sql = sql::statement_sql(args.statement);
+      instrumentation_->report_slow(Library::SlowQuery{
+          .sql = sql,
+          .elapsed = elapsed,
+          .plan = query_plan_locked(sql),
+      });
+    }
+
+    return result;
+  }
+
+ private:
+  // EXPLAIN QUERY PLAN of `sql`, or an empty string if it cannot be
+  // explained. Expects the connection to be locked.
+  auto query_plan_locked(std::string_view sql) -> std::string {
+    auto const explain = std::format("EXPLAIN QUERY PLAN {}", sql);
+    sqlite3_stmt* raw = nullptr;
+    if (sqlite3_prepare_v2(db_.get(), explain.data(),
+                           static_cast<int>(explain.size()), &raw, nullptr)) {
+      return {};
+    }
+
+    unique_sqlite3_stmt stmt(raw);
+    // Rows are (id, parent, notused, detail), parents before their children.
+    std::unordered_map<int, std::size_t> depths;
+    std::string plan;
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+      auto const parent = depths.find(sqlite3_column_int(stmt.get(), 1));
+      auto const depth = parent != depths.end() ? parent->second + 1 : 0;
+      depths[sqlite3_column_int(stmt.get(), 0)] = depth;
+      plan += std::string(2 * depth, ' ');
+      plan += column_string_view(stmt.get(), 3);
+      plan += '\n';
+    }
+
+    return plan;
+  }
+
+  // Runs a prepared and bound statement to completion, counting the rows it
+  // returns into `rows`.
+  auto step_locked(sqlite3_stmt* stmt, ExecuteArgs const& args,
+                   std::uint64_t& rows) -> std::expected<int, Error> {
+    for (;;) {
+      switch (sqlite3_step(stmt)) {
+        case SQLITE_ROW:
+          ++rows;
+          if (args.callback != nullptr &&
+              args.callback(args.callback_arg, stmt)) {
+            log("callback requested abort");
+            return std::unexpected(Error::UNEXPECTED);
+          }
+          continue;
+        case SQLITE_DONE:
+          return sqlite3_changes(db_.get());
+        default:
+          log(sqlite3_errmsg(db_.get()));
+          return std::unexpected(Error::UNEXPECTED);
+      }
+    }
+  }
+};
+
+// In-memory copy of every record's acquired flag. Lookups take a shared lock
+// on one of SHARD_COUNT shards and flip the flag with a compare-and-swap, so
+// acquisitions of different books do not contend.
+class AvailabilityIndex {
+  static constexpr std::size_t SHARD_COUNT = 64;
+
+  struct Shard {
+    std::shared_mutex mutex;
+    std::unordered_map<UUID, std::atomic<bool>> acquired;
+  };
+
+  std::array<Shard, SHARD_COUNT> shards_;
+
+  auto shard(UUID const& uuid) -> Shard& {
+    return shards_[std::hash<UUID>{}(uuid) % SHARD_COUNT];
+  }
+
+ public:
+  auto insert(UUID uuid, bool acquired) -> void {
+    auto& shard = this->shard(uuid);
+    std::unique_lock lk(shard.mutex);
+    shard.acquired.try_emplace(uuid, acquired);
+  }
+
+  auto erase(UUID uuid) -> void {
+    auto& shard = this->shard(uuid);
+    std::unique_lock lk(shard.mutex);
+    shard.acquired.erase(uuid);
+  }
+
+  auto acquired(UUID uuid) -> std::optional<bool> {
+    auto& shard = this->shard(uuid);
+    std::shared_lock lk(shard.mutex);
+    auto it = shard.acquired.find(uuid);
+    if (it == shard.acquired.end()) {
+      return std::nullopt;
+    }
+
+    return it->second.load(std::memory_order_acquire);
+  }
+
+  // Sets the flag to `acquired`; false when the record is unknown or the
+  // flag already had that value.
+  auto exchange(UUID uuid, bool acquired) -> bool {
+    auto& shard = this->shard(uuid);
+    std::shared_lock lk(shard.mutex);
+    auto it = shard.acquired.find(uuid);
+    if (it == shard.acquired.end()) {
+      return false;
+    }
+
+    auto expected = !acquired;
+    return it->second.compare_exchange_strong(expected, acquired,
+                                              std::memory_order_acq_rel);
+  }
+};
+
+// Reads a row produced by `SELECT uuid, acquired` into an AvailabilityIndex.
+static auto read_availability(void* index, sqlite3_stmt* stmt) -> int {
+  auto opt_uuid = column_uuid(stmt, 0);
+  if (!opt_uuid.has_value()) {
+    return 1;
+  }
+
+  static_cast<AvailabilityIndex*>(index)->insert(
+      *opt_uuid, sqlite3_column_int(stmt, 1) != 0);
+  return 0;
+}
+
+// Bounded LRU cache of records split into SHARD_COUNT independently locked
+// shards. Every change to a shard bumps its generation; a record read from
+// the database is only cached if the generation it was read under is still
+// current, so a lookup racing with a mutation cannot cache stale data.
+class RecordCache {
+  static constexpr std::size_t SHARD_COUNT = 16;
+
+  struct Shard {
+    std::mutex mutex;
+    std::uint64_t generation = 0;
+    // Most recently used first.
+    std::list<Library::Record> lru;
+    std::unordered_map<UUID, std::list<Library::Record>::iterator> entries;
+  };
+
+  std::size_t shard_capacity_;
+  std::array<Shard, SHARD_COUNT> shards_;
+  std::atomic<std::size_t> hits_ = 0;
+  std::atomic<std::size_t> misses_ = 0;
+
+  auto shard(UUID const& uuid) -> Shard& {
+    return shards_[std::hash<UUID>{}(uuid) % SHARD_COUNT];
+  }
+
+ public:
+  explicit RecordCache(std::size_t capacity)
+      : shard_capacity_((capacity + SHARD_COUNT - 1) / SHARD_COUNT) {}
+
+  // Returns the cached record, or the shard generation to pass to fill()
+  // after reading the record from the database.
+  auto get(UUID uuid) -> std::expected<Library::Record, std::uint64_t> {
+    auto& shard = this->shard(uuid);
+    std::lock_guard lk(shard.mutex);
+    auto it = shard.entries.find(uuid);
+    if (it == shard.entries.end()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return std::unexpected(shard.generation);
+    }
+
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return *it->second;
+  }
+
+  auto fill(Library::Record record, std::uint64_t generation) -> void {
+    auto& shard = this->shard(record.uuid);
+    std::lock_guard lk(shard.mutex);
+    if (shard.generation != generation ||
+        shard.entries.contains(record.uuid)) {
+      return;
+    }
+
+    auto const uuid = record.uuid;
+    shard.lru.push_front(std::move(record));
+    shard.entries.emplace(uuid, shard.lru.begin());
+    if (shard.lru.size() > shard_capacity_) {
+      shard.entries.erase(shard.lru.back().uuid);
+      shard.lru.pop_back();
+    }
+  }
+
+  auto set_acquired(UUID uuid, bool acquired) -> void {
+    auto& shard = this->shard(uuid);
+    std::lock_guard lk(shard.mutex);
+    ++shard.generation;
+    if (auto it = shard.entries.find(uuid); it != shard.entries.end()) {
+      it->second->acquired = acquired;
+    }
+  }
+
+  auto erase(UUID uuid) -> void {
+    auto& shard = this->shard(uuid);
+    std::lock_guard lk(shard.mutex);
+    ++shard.generation;
+    if (auto it = shard.entries.find(uuid); it != shard.entries.end()) {
+      shard.lru.erase(it->second);
+      shard.entries.erase(it);
+    }
+  }
+
+  auto stats() const -> Library::CacheStats {
+    return Library::CacheStats{
+        .hits = hits_.load(std::memory_order_relaxed),
+        .misses = misses_.load(std::memory_order_relaxed),
+    };
+  }
+};
+
+// Writes acquired flag changes to the database on a background thread. A
+// batch is written once MAX_BATCH_SIZE changes are queued or FLUSH_INTERVAL
+// has passed, whichever comes first; the destructor writes what is left.
+//
+// Only UUIDs are queued. The flag written is read from the index when the
+// batch is written, so a flip and its push racing with another flip of the
+// same copy cannot leave an older value in the database: the last push
+// always happens after the last flip.
+class DeferredWriter {
+  static constexpr std::size_t MAX_BATCH_SIZE = 1'024;
+  static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(50);
+  // Retries of a failed batch back off from FLUSH_INTERVAL up to this.
+  static constexpr auto MAX_BACKOFF = std::chrono::milliseconds(1'600);
+  // Attempts at writing what is left once the writer is stopping.
+  static constexpr int SHUTDOWN_ATTEMPTS = 3;
+
+  Connection& writer_;
+  AvailabilityIndex& index_;
+  // Runs after every committed batch.
+  std::function<void()> on_written_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<UUID> pending_;
+  bool stopping_ = false;
+  // Set while a failed batch waits to be retried.
+  std::atomic<bool> failing_ = false;
+  // Declared last so it starts after, and is joined before, the members it
+  // uses are destroyed.
+  std::thread thread_;
+
+  auto write(std::vector<UUID>& batch) -> bool {
+    std::ranges::sort(batch);
+    batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+    auto result = writer_.transaction(
+        [this,
+         &batch](Connection& writer) -> std::expected<void, Library::Error> {
+          for (auto const& uuid : batch) {
+            // Erased since it was queued.
+            auto const acquired = index_.acquired(uuid);
+            if (!acquired.has_value()) {
+              continue;
+            }
+
+            if (auto result = writer.execute_locked(Connection::ExecuteArgs{
+                    .statement = sql::Statement::SET_ACQUIRED,
+                    .params = {sql::uuid_param(uuid),
+                               std::int64_t{*acquired}},
+                });
+                !result.has_value()) {
+              return std::unexpected(result.error());
+            }
+          }
+
+          return {};
+        });
+
+    if (!result.has_value()) {
+      log(std::format("failed to write {} deferred acquired flags",
+                      batch.size()));
+      return false;
+    }
+
+    on_written_();
+    return true;
+  }
+
+  auto run() -> void {
+    std::vector<UUID> batch;
+    auto backoff = FLUSH_INTERVAL;
+    auto shutdown_attempts = 0;
+    for (auto stopping = false;;) {
+      {
+        std::unique_lock lk(mutex_);
+        if (!stopping) {
+          cv_.wait_for(lk, backoff, [this] {
+            return stopping_ ||
+                   (!failing_ && pending_.size() >= MAX_BATCH_SIZE);
+          });
+        }
+
+        batch.swap(pending_);
+        stopping = stopping_;
+      }
+
+      if (batch.empty() || write(batch)) {
+        batch.clear();
+        failing_ = false;
+        backoff = FLUSH_INTERVAL;
+        if (stopping) {
+          return;
+        }
+
+        continue;
+      }
+
+      // Put back ahead of whatever was queued meanwhile and retried later.
+      std::size_t pending;
+      {
+        std::lock_guard lk(mutex_);
+        pending_.insert(pending_.begin(), batch.begin(), batch.end());
+        pending = pending_.size();
+      }
+
+      batch.clear();
+      failing_ = true;
+      if (stopping) {
+        if (++shutdown_attempts == SHUTDOWN_ATTEMPTS) {
+          log(std::format("lost {} deferred acquired flags", pending));
+          return;
+        }
+
+        std::this_thread::sleep_for(backoff);
+      }
+
+      backoff = std::min(backoff * 2, MAX_BACKOFF);
+    }
+  }
+
+ public:
+  DeferredWriter(Connection& writer, AvailabilityIndex& index,
+                 std::function<void()> on_written)
+      : writer_(writer),
+        index_(index),
+        on_written_(std::move(on_written)),
+        thread_([this] { run(); }) {}
+
+  // Writes what is still queued, retrying a failing batch a few times.
+  ~DeferredWriter() {
+    {
+      std::lock_guard lk(mutex_);
+      stopping_ = true;
+    }
+
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  // Whether the last batch failed to commit and waits to be retried.
+  auto failing() const -> bool { return failing_; }
+
+  // Queues the copy's flag, to be written as the index holds it then. Call
+  // after flipping it in the index.
+  auto push(UUID uuid) -> void {
+    std::size_t pending;
+    {
+      std::lock_guard lk(mutex_);
+      pending_.push_back(uuid);
+      pending = pending_.size();
+    }
+
+    if (pending == MAX_BATCH_SIZE) {
+      cv_.notify_one();
+    }
+  }
+};
+
+// Commits mutations queued by concurrent callers on a background thread,
+// many per transaction, so they share the cost of a commit. Every mutation
+// runs in its own savepoint and fails alone; a failed commit fails the
+// whole batch.
+class GroupCommitWriter {
+ public:
+  using Mutation =
+      std::function<std::expected<void, Library::Error>(Connection&)>;
+
+ private:
+  struct Pending {
+    Mutation mutation;
+    std::promise<std::expected<void, Library::Error>> done;
+  };
+
+  Connection& writer_;
+  std::size_t max_batch_size_;
+  std::chrono::microseconds max_latency_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Pending> pending_;
+  bool stopping_ = false;
+  // Declared last so it starts after, and is joined before, the members it
+  // uses are destroyed.
+  std::thread thread_;
+
+  auto commit(std::span<Pending> batch) -> void {
+    std::vector<std::expected<void, Library::Error>> outcomes;
+    outcomes.reserve(batch.size());
+    auto committed = writer_.transaction(
+        [&](Connection& writer) -> std::expected<void, Library::Error> {
+          for (auto& pending : batch) {
+            outcomes.push_back(writer.savepoint_locked(pending.mutation));
+          }
+
+          return {};
+        });
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      batch[i].done.set_value(committed.has_value()
+                                  ? outcomes[i]
+                                  : std::unexpected(committed.error()));
+    }
+  }
+
+  auto run() -> void {
+    std::vector<Pending> batch;
+    for (auto stopping = false; !stopping;) {
+      {
+        std::unique_lock lk(mutex_);
+        cv_.wait(lk, [this] { return stopping_ || !pending_.empty(); });
+        // Gives concurrent callers up to max_latency_ to fill the batch.
+        cv_.wait_for(lk, max_latency_, [this] {
+          return stopping_ || pending_.size() >= max_batch_size_;
+        });
+
+        auto const n = std::min(pending_.size(), max_batch_size_);
+        batch.assign(std::make_move_iterator(pending_.begin()),
+                     std::make_move_iterator(pending_.begin() + n));
+        pending_.erase(pending_.begin(), pending_.begin() + n);
+        stopping = stopping_ && pending_.empty();
+      }
+
+      if (!batch.empty()) {
+        commit(batch);
+        batch.clear();
+      }
+    }
+  }
+
+ public:
+  GroupCommitWriter(Connection& writer, std::size_t max_batch_size,
+                    std::chrono::microseconds max_latency)
+      : writer_(writer),
+        max_batch_size_(std::max<std::size_t>(max_batch_size, 1)),
+        max_latency_(max_latency),
+        thread_([this] { run(); }) {}
+
+  ~GroupCommitWriter() {
+    {
+      std::lock_guard lk(mutex_);
+      stopping_ = true;
+    }
+
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  // Queues `mutation` and waits until the transaction carrying it commits.
+  auto write(Mutation mutation) -> std::expected<void, Library::Error> {
+    std::future<std::expected<void, Library::Error>> done;
+    std::size_t pending;
+    {
+      std::lock_guard lk(mutex_);
+      pending_.push_back(Pending{.mutation = std::move(mutation)});
+      done = pending_.back().done.get_future();
+      pending = pending_.size();
+    }
+
+    if (pending == 1 || pending == max_batch_size_) {
+      cv_.notify_one();
+    }
+
+    return done.get();
+  }
+};
+
+// Hands the changes committed through the library to subscribers. After
+// every commit change_log is read on from the last delivered sequence, so
+// each subscriber sees every change once and in order.
+class ChangeFeed {
+  // Changes logged between two trims of the change log down to its
+  // retention, so that one transaction trims many of them.
+  static constexpr std::uint64_t RETAIN_INTERVAL = 64;
+
+  Connection& writer_;
+  std::size_t retention_ = 0;
+  // Last sequence number of the log when it was last trimmed.
+  std::atomic<std::uint64_t> trimmed_ = 0;
+  std::mutex mutex_;
+  // Lets publish skip the mutex while nobody is subscribed.
+  std::atomic<bool> active_ = false;
+  std::uint64_t last_ = 0;
+  std::uint64_t next_id_ = 0;
+  std::vector<std::pair<std::uint64_t, Library::ChangeHandler>> subscribers_;
+
+ public:
+  explicit ChangeFeed(Connection& writer) : writer_(writer) {}
+
+  // Changes kept in the log by retain(); zero keeps all of them.
+  auto set_retention(std::size_t retention) -> void { retention_ = retention; }
+
+  // Drops the changes beyond the retention once RETAIN_INTERVAL more were
+  // logged since the last trim, however many commits logged them. Expects
+  // the writer connection not to be locked by the caller.
+  auto retain() -> void {
+    if (retention_ == 0) {
+      return;
+    }
+
+    std::size_t last = 0;
+    if (auto result = writer_.execute(Connection::ExecuteArgs{
+            .statement = sql::Statement::LAST_CHANGE,
+            .callback = read_count,
+            .callback_arg = &last,
+        });
+        !result.has_value()) {
+      log("failed to read the change log sequence");
+      return;
+    }
+
+    // Whoever advances trimmed_ trims; the other commits racing with it
+    // leave the log to that trim.
+    auto trimmed = trimmed_.load(std::memory_order_relaxed);
+    if (last < trimmed + RETAIN_INTERVAL ||
+        !trimmed_.compare_exchange_strong(trimmed, last,
+                                          std::memory_order_relaxed)) {
+      return;
+    }
+
+    auto result = writer_.transaction(
+        [this](Connection& writer) -> std::expected<void, Library::Error> {
+          return writer
+              .execute_locked(Connection::ExecuteArgs{
+                  .statement = sql::Statement::RETAIN_CHANGES,
+                  .params = {static_cast<std::int64_t>(retention_)},
+              })
+              .transform([](int /* n affected rows */) {});
+        });
+    if (!result.has_value()) {
+      // Lets the next commit try again.
+      trimmed_.store(trimmed, std::memory_order_relaxed);
+      log("failed to trim the change log");
+    }
+  }
+
+  auto subscribe(Library::ChangeHandler handler)
+      -> std::expected<Library::Subscription, Library::Error> {
+    std::lock_guard lk(mutex_);
+    if (subscribers_.empty()) {
+      // Set before reading the last sequence, so commits racing with it
+      // wait for the mutex and are published rather than skipped.
+      active_ = true;
+      std::size_t last = 0;
+      if (auto result = writer_.execute(Connection::ExecuteArgs{
+              .statement = sql::Statement::LAST_CHANGE,
+              .callback = read_count,
+              .callback_arg = &last,
+          });
+          !result.has_value()) {
+        active_ = false;
+        return std::unexpected(result.error());
+      }
+
+      last_ = last;
+    }
+
+    subscribers_.emplace_back(++next_id_, std::move(handler));
+    return Library::Subscription{.id = next_id_, .sequence = last_};
+  }
+
+  auto unsubscribe(std::uint64_t id) -> void {
+    std::lock_guard lk(mutex_);
+    std::erase_if(subscribers_, [id](auto const& subscriber) {
+      return subscriber.first == id;
+    });
+    active_ = !subscribers_.empty();
+  }
+
+  // Delivers the changes committed since the last call. Expects the writer
+  // connection not to be locked by the caller.
+  auto publish() -> void {
+    if (!active_) {
+      return;
+    }
+
+    std::lock_guard lk(mutex_);
+    if (subscribers_.empty()) {
+      return;
+    }
+
+    std::vector<Library::Change> changes;
+    if (auto result = writer_.execute(Connection::ExecuteArgs{
+            .statement = sql::Statement::CHANGES,
+            .params = {static_cast<std::int64_t>(last_), std::int64_t{-1}},
+            .callback = read_change,
+            .callback_arg = &changes,
+        });
+        !result.has_value()) {
+      log("failed to read committed changes");
+      return;
+    }
+
+    if (changes.empty()) {
+      return;
+    }
+
+    last_ = changes.back().sequence;
+    for (auto const& [id, handler] : subscribers_) {
+      handler(changes);
+    }
+  }
+};
+
+class Library::Impl {
+  // Declared first so every connection and background writer using it is
+  // gone before it is destroyed.
+  std::unique_ptr<Instrumentation> instrumentation_;
+  Connection writer_;
+  // Declared after writer_, which it reads from, and before deferred_,
+  // which publishes to it.
+  ChangeFeed feed_;
+  // Read-only connections to the same database file; empty when reads share
+  // the writer connection.
+  std::vector<std::unique_ptr<Connection>> readers_;
+  std::atomic<std::size_t> next_reader_ = 0;
+  UUIDVersion uuid_version_;
+  std::unique_ptr<AvailabilityIndex> availability_;
+  std::unique_ptr<RecordCache> cache_;
+  // Declared after writer_ so queued flags are written before the writer
+  // connection closes.
+  std::unique_ptr<DeferredWriter> deferred_;
+  std::unique_ptr<GroupCommitWriter> group_commit_;
+
+  struct Lease {
+    Connection& connection;
+    std::unique_lock<std::mutex> lock;
+  };
+
+  // Locks an idle reader, or waits for one picked round-robin when all of
+  // them are busy. The wait is recorded against `statement`. DB_CONNECTION
+  // when every connection it could wait for is held by a cursor of the
+  // calling thread.
+  auto lease_reader(sql::Statement statement) -> std::expected<Lease, Error> {
+    if (instrumentation_ == nullptr) {
+      return lease_any_reader();
+    }
+
+    auto const start = Instrumentation::now();
+    auto lease = lease_any_reader();
+    instrumentation_->record_lock_wait(statement, start);
+    return lease;
+  }
+
+  auto lease_any_reader() -> std::expected<Lease, Error> {
+    if (readers_.empty()) {
+      if (writer_.held_by_caller()) {
+        log("connection is held by a cursor of this thread");
+        return std::unexpected(Error::DB_CONNECTION);
+      }
+
+      return Lease{writer_, writer_.lock()};
+    }
+
+    auto const start = next_reader_.fetch_add(1, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < readers_.size(); ++i) {
+      auto& reader = *readers_[(start + i) % readers_.size()];
+      if (auto lk = reader.try_lock(); lk.owns_lock()) {
+        return Lease{reader, std::move(lk)};
+      }
+    }
+
+    for (std::size_t i = 0; i < readers_.size(); ++i) {
+      auto& reader = *readers_[(start + i) % readers_.size()];
+      if (!reader.held_by_caller()) {
+        return Lease{reader, reader.lock()};
+      }
+    }
+
+    log("every reader is held by a cursor of this thread");
+    return std::unexpected(Error::DB_CONNECTION);
+  }
+
+ public:
+  using ExecuteArgs = Connection::ExecuteArgs;
+
+  explicit Impl(unique_sqlite3 writer,
+                UUIDVersion uuid_version = UUIDVersion::V4)
+      : writer_(std::move(writer)),
+        feed_(writer_),
+        uuid_version_(uuid_version) {}
+
+  auto make_uuid() const -> UUID { return tbrekalo::make_uuid(uuid_version_); }
+
+  auto add_reader(unique_sqlite3 reader) -> void {
+    readers_.push_back(std::make_unique<Connection>(std::move(reader)));
+    readers_.back()->set_instrumentation(instrumentation_.get());
+  }
+
+  auto writer() -> Connection& { return writer_; }
+
+  // Loads the acquired flags of all records into an availability index that
+  // serves acquire_book and release_book from then on.
+  auto load_availability(Durability durability) -> std::expected<void, Error> {
+    auto index = std::make_unique<AvailabilityIndex>();
+    if (auto result = writer_.execute(ExecuteArgs{
+            .statement = sql::Statement::AVAILABILITY,
+            .callback = read_availability,
+            .callback_arg = index.get(),
+        });
+        !result.has_value()) {
+      return std::unexpected(result.error());
+    }
+
+    availability_ = std::move(index);
+    if (durability == Durability::DEFERRED) {
+      deferred_ = std::make_unique<DeferredWriter>(
+          writer_, *availability_, [this] { on_committed(); });
+    }
+
+    return {};
+  }
+
+  auto enable_group_commit(std::size_t max_batch_size,
+                           std::chrono::microseconds max_latency) -> void {
+    group_commit_ = std::make_unique<GroupCommitWriter>(
+        writer_, max_batch_size, max_latency);
+  }
+
+  // Runs `mutation` in a write transaction of its own, or in a shared one
+  // under group commit. Returns once the change is committed and published
+  // to subscribers.
+  auto write(GroupCommitWriter::Mutation const& mutation)
+      -> std::expected<void, Error> {
+    if (group_commit_ != nullptr && writer_.held_by_caller()) {
+      // The background writer would wait for the cursor forever.
+      log("connection is held by a cursor of this thread");
+      return std::unexpected(Error::DB_CONNECTION);
+    }
+
+    auto result = group_commit_ != nullptr ? group_commit_->write(mutation)
+                                           : writer_.transaction(mutation);
+    if (result.has_value()) {
+      on_committed();
+    }
+
+    return result;
+  }
+
+  auto on_committed() -> void {
+    feed_.publish();
+    feed_.retain();
+  }
+
+  auto changes(std::uint64_t sequence, std::size_t limit)
+      -> std::expected<std::vector<Change>, Error> {
+    std::vector<Change> changes;
+    return read(ExecuteArgs{
+                    .statement = sql::Statement::CHANGES,
+                    .params = {static_cast<std::int64_t>(sequence),
+                               static_cast<std::int64_t>(std::min<std::size_t>(
+                                   limit, INT64_MAX))},
+                    .callback = read_change,
+                    .callback_arg = &changes,
+                })
+        .transform([&changes](int /* n affected rows */) {
+          return std::move(changes);
+        });
+  }
+
+  auto feed() -> ChangeFeed& { return feed_; }
+  auto set_change_log_retention(std::size_t retention) -> void {
+    feed_.set_retention(retention);
+  }
+
+  auto enable_metrics(
+      std::chrono::nanoseconds slow_query_threshold,
+      std::function<void(SlowQuery const&)> on_slow_query) -> void {
+    instrumentation_ = std::make_unique<Instrumentation>(
+        slow_query_threshold, std::move(on_slow_query));
+    writer_.set_instrumentation(instrumentation_.get());
+    for (auto& reader : readers_) {
+      reader->set_instrumentation(instrumentation_.get());
+    }
+  }
+
+  auto metrics() const -> Metrics {
+    return instrumentation_ != nullptr ? instrumentation_->snapshot()
+                                       : Metrics{};
+  }
+
+  auto enable_cache(std::size_t capacity) -> void {
+    cache_ = std::make_unique<RecordCache>(capacity);
+  }
+
+  auto cache_stats() const -> CacheStats {
+    return cache_ != nullptr ? cache_->stats() : CacheStats{};
+  }
+
+  // Looks the record up in the cache before the database. Its acquired flag
+  // comes from the availability index when there is one, as deferred flag
+  // changes may not have reached the database yet.
+  auto find(UUID uuid) -> std::expected<Record, Error> {
+    std::uint64_t generation = 0;
+    if (cache_ != nullptr) {
+      auto cached = cache_->get(uuid);
+      if (cached.has_value()) {
+        return *std::move(cached);
+      }
+
+      generation = cached.error();
+    }
+
+    auto records = fetch_records(ExecuteArgs{
+        .statement = sql::Statement::FIND,
+        .params = {sql::uuid_param(uuid)},
+    });
+    if (!records.has_value()) {
+      return std::unexpected(records.error());
+    }
+
+    if (records->empty()) {
+      return std::unexpected(Error::INVALID_ARGUMENT);
+    }
+
+    auto record = std::move(records->front());
+    if (availability_ != nullptr) {
+      record.acquired = availability_->acquired(uuid).value_or(record.acquired);
+    }
+
+    if (cache_ != nullptr) {
+      cache_->fill(record, generation);
+    }
+
+    return record;
+  }
+
+  // Adds one copy of `book`, creating its catalog entry when the ISBN is
+  // new. INVALID_ARGUMENT when the catalog holds the ISBN under another name
+  // or author. Expects `writer` to be locked inside a transaction.
+  static auto insert_locked(Connection& writer, UUID const& uuid,
+                            Book const& book) -> std::expected<void, Error> {
+    return writer
+        .execute_locked(ExecuteArgs{
+            .statement = sql::Statement::INSERT_BOOK,
+            .params = {sql::isbn_param(book.isbn), book.name, book.author},
+        })
+        .and_then([&](int created) -> std::expected<void, Error> {
+          if (created != 0) {
+            return {};
+          }
+
+          std::size_t matches = 0;
+          return writer
+              .execute_locked(ExecuteArgs{
+                  .statement = sql::Statement::BOOK_MATCHES,
+                  .params = {sql::isbn_param(book.isbn), book.name,
+                             book.author},
+                  .callback = read_count,
+                  .callback_arg = &matches,
+              })
+              .and_then([&](int /* n affected rows */)
+                            -> std::expected<void, Error> {
+                if (matches == 0) {
+                  return std::unexpected(Error::INVALID_ARGUMENT);
+                }
+
+                return {};
+              });
+        })
+        .and_then([&] {
+          return writer.execute_locked(ExecuteArgs{
+              .statement = sql::Statement::INSERT_COPY,
+              .params = {sql::uuid_param(uuid), sql::isbn_param(book.isbn),
+                         std::int64_t{0}},
+          });
+        })
+        .transform([](int /* n affected rows */) {});
+  }
+
+  // Adds a copy of books[i] under uuids[i] for every i, in one transaction.
+  auto insert(std::span<UUID const> uuids, std::span<Book const> books)
+      -> std::expected<void, Error> {
+    return write([&](Connection& writer) -> std::expected<void, Error> {
+             for (std::size_t i = 0; i < books.size(); ++i) {
+               auto result = insert_locked(writer, uuids[i], books[i]);
+               if (!result.has_value()) {
+                 log(std::format("book {} of {} failed; rolling back the batch",
+                                 i, books.size()));
+                 return std::unexpected(result.error());
+               }
+             }
+
+             return {};
+           })
+        .transform([this, uuids] { on_inserted(uuids); });
+  }
+
+  // insert with each book in a savepoint of its own, so failing books are
+  // reported in their slot while the others commit.
+  auto insert_each(std::span<UUID const> uuids, std::span<Book const> books)
+      -> std::expected<Insertions, Error> {
+    Insertions outcomes;
+    auto result = write([&](Connection& writer) -> std::expected<void, Error> {
+      outcomes.clear();
+      outcomes.reserve(books.size());
+      for (std::size_t i = 0; i < books.size(); ++i) {
+        outcomes.push_back(
+            writer
+                .savepoint_locked([&](Connection& connection) {
+                  return insert_locked(connection, uuids[i], books[i]);
+                })
+                .transform([&] { return uuids[i]; }));
+      }
+
+      return {};
+    });
+
+    if (!result.has_value()) {
+      return std::unexpected(result.error());
+    }
+
+    for (auto const& outcome : outcomes) {
+      if (outcome.has_value()) {
+        on_inserted(std::span(&*outcome, 1));
+      }
+    }
+
+    return outcomes;
+  }
+
+  auto copies(ISBN const& isbn) -> std::expected<std::vector<UUID>, Error> {
+    std::vector<UUID> uuids;
+    return read(ExecuteArgs{
+                    .statement = sql::Statement::COPIES,
+                    .params = {sql::isbn_param(isbn)},
+                    .callback = read_uuid,
+                    .callback_arg = &uuids,
+                })
+        .transform([&uuids](int /* n affected rows */) {
+          return std::move(uuids);
+        });
+  }
+
+  // With an availability index the flags are taken from the index, as
+  // deferred changes may not have reached the database yet.
+  auto available_copies(ISBN const& isbn) -> std::expected<std::size_t, Error> {
+    if (availability_ != nullptr) {
+      return copies(isbn).transform([this](std::vector<UUID> uuids) {
+        return static_cast<std::size_t>(
+            std::ranges::count_if(uuids, [this](UUID const& uuid) {
+              return availability_->acquired(uuid) == false;
+            }));
+      });
+    }
+
+    std::size_t count;
+    return read(ExecuteArgs{
+                    .statement = sql::Statement::AVAILABLE_COPIES,
+                    .params = {sql::isbn_param(isbn)},
+                    .callback = read_count,
+                    .callback_arg = &count,
+                })
+        .transform([&count](int /* n affected rows */) { return count; });
+  }
 
-static auto make_insert_sql(Library::Record const& record) -> std::string {
-  return std::format(INSERT_FMT, UUIDString(record.uuid).data(),
-                     record.isbn.data(), record.name, record.author,
-                     static_cast<int>(record.acquired));
-}
+  // Without an availability index a single UPDATE ... RETURNING picks and
+  // acquires a copy through idx_copy_isbn_acquired. With one, copies are
+  // tried in turn against the index.
+  auto acquire_any(ISBN const& isbn) -> std::expected<UUID, Error> {
+    if (availability_ != nullptr) {
+      auto uuids = copies(isbn);
+      if (!uuids.has_value()) {
+        return std::unexpected(uuids.error());
+      }
 
-static constexpr auto ERASE_FMT = R"(DELETE FROM record WHERE uuid='{}')";
+      for (auto const& uuid : *uuids) {
+        auto result = execute_acquisition(sql::Statement::ACQUIRE_RECORD, uuid);
+        if (result.has_value()) {
+          return uuid;
+        }
 
-static auto make_erase_sql(UUID uuid) -> std::string {
-  return std::format(ERASE_FMT, UUIDString(uuid).data());
-}
+        if (result.error() != Error::INVALID_ARGUMENT) {
+          return std::unexpected(result.error());
+        }
+      }
 
-static constexpr auto COUNT_SQL = R"(SELECT COUNT(*) FROM record;)";
+      return std::unexpected(Error::INVALID_ARGUMENT);
+    }
 
-static constexpr auto DISTINCT_SQL =
-    R"(SELECT COUNT(DISTINCT isbn) FROM record;)";
+    std::vector<UUID> acquired;
+    if (auto result = write([&](Connection& writer) {
+          return writer
+              .execute_locked(ExecuteArgs{
+                  .statement = sql::Statement::ACQUIRE_ANY,
+                  .params = {sql::isbn_param(isbn)},
+                  .callback = read_uuid,
+                  .callback_arg = &acquired,
+              })
+              .transform([](int /* n affected rows */) {});
+        });
+        !result.has_value()) {
+      return std::unexpected(result.error());
+    }
 
-static constexpr auto RECORDS_SQL = R"(SELECT * FROM record;)";
+    if (acquired.empty()) {
+      return std::unexpected(Error::INVALID_ARGUMENT);
+    }
 
-static constexpr auto NAME_LIKE_FMT =
-    R"(SELECT DISTINCT * FROM record WHERE name LIKE '%{}%';)";
+    on_acquisition(acquired.front(), true);
+    return acquired.front();
+  }
 
-static auto make_name_like_sql(std::string_view name_like) -> std::string {
-  return std::format(NAME_LIKE_FMT, name_like);
-}
+  // Keeps the availability index, if any, in step with committed inserts
+  // and erases.
+  auto on_inserted(std::span<UUID const> uuids) -> void {
+    if (availability_ != nullptr) {
+      for (auto const& uuid : uuids) {
+        availability_->insert(uuid, false);
+      }
+    }
+  }
 
-static constexpr auto AUTHOR_LIKE_FMT =
-    R"(SELECT DISTINCT * FROM record WHERE author LIKE '%{}%';)";
+  auto on_erased(UUID uuid) -> void {
+    if (availability_ != nullptr) {
+      availability_->erase(uuid);
+    }
 
-static auto make_author_like_sql(std::string_view author_like) -> std::string {
-  return std::format(AUTHOR_LIKE_FMT, author_like);
-}
+    if (cache_ != nullptr) {
+      cache_->erase(uuid);
+    }
+  }
 
-static constexpr auto ACQUIRE_RECORD_FMT =
-    R"(UPDATE record SET acquired=1 WHERE uuid='{}' AND acquired=0;)";
+  auto on_acquisition(UUID uuid, bool acquired) -> void {
+    if (cache_ != nullptr) {
+      cache_->set_acquired(uuid, acquired);
+    }
+  }
 
-static auto make_acquire_record_sql(UUIDString uuid) -> std::string {
-  return std::format(ACQUIRE_RECORD_FMT, static_cast<char const*>(uuid));
-}
+  auto read(ExecuteArgs args) -> std::expected<int, Error> {
+    auto lease = lease_reader(args.statement);
+    if (!lease.has_value()) {
+      return std::unexpected(lease.error());
+    }
 
-static constexpr auto RELEASE_RECORD_FMT =
-    R"(UPDATE record SET acquired=0 WHERE uuid='{}' AND acquired=1;)";
+    return lease->connection.execute_locked(args);
+  }
 
-static auto make_release_record_sql(UUIDString uuid) -> std::string {
-  return std::format(RELEASE_RECORD_FMT, static_cast<char const*>(uuid));
-}
+  // Opens a cursor over a record query; `pattern`, when given, is bound to ?1.
+  auto open_cursor(sql::Statement statement,
+                   std::optional<std::string> pattern = std::nullopt)
+      -> std::expected<std::unique_ptr<CursorState>, Error> {
+    auto lease = lease_reader(statement);
+    if (!lease.has_value()) {
+      return std::unexpected(lease.error());
+    }
 
-}  // namespace tbrekalo::sql
+    auto& connection = lease->connection;
+    if (connection.handle() == nullptr) {
+      return std::unexpected(Error::DB_CONNECTION);
+    }
 
-namespace tbrekalo {
+    auto* stmt = connection.prepare(statement);
+    if (stmt == nullptr) {
+      return std::unexpected(Error::UNEXPECTED);
+    }
 
-static auto parse_count(void* count, int n, char** values, char** variables)
-    -> int {
-  assert(n == 1);
-  if (sscanf(values[0], "%zu", static_cast<std::size_t*>(count))) {
-    return 0;
+    auto const has_pattern = pattern.has_value();
+    auto state = std::make_unique<CursorState>(
+        std::move(lease->lock), connection.cursor_thread(), stmt,
+        std::move(pattern).value_or(""));
+    if (has_pattern && !state->bind_pattern()) {
+      log(sqlite3_errmsg(connection.handle()));
+      return std::unexpected(Error::UNEXPECTED);
+    }
+
+    state->advance();
+    return state;
   }
-  return 1;
-}
 
-static auto parse_record(void* records_vec_void_ptr, int n, char** values,
-                         char** variables) -> int {
-  auto& records =
-      *reinterpret_cast<std::vector<Library::Record>*>(records_vec_void_ptr);
-  Library::Record record;
-
-  for (int i = 0; i < n; ++i) {
-    auto const variable_sv = std::string_view(variables[i]);
-    auto const value_sv = std::string_view(values[i]);
-    if (variable_sv == "uuid") {
-      if (auto opt_uuid = make_uuid_string(value_sv); opt_uuid.has_value()) {
-        record.uuid = static_cast<UUID>(UUIDString(*opt_uuid));
-        continue;
-      }
+  auto fetch_records(ExecuteArgs args)
+      -> std::expected<std::vector<Record>, Error> {
+    std::vector<Record> records;
+    args.callback = read_record;
+    args.callback_arg = &records;
+    return read(args).transform(
+        [records_ptr = &records](int) -> std::vector<Record> {
+          return std::vector(std::move(*records_ptr));
+        });
+  }
 
-      return 1;
+  // Fetches one page with statements[order]. One row beyond the page tells
+  // whether another page follows.
+  auto fetch_page(std::array<sql::Statement, 3> const& statements,
+                  PageQuery const& query,
+                  std::optional<std::string_view> pattern)
+      -> std::expected<Page, Error> {
+    if (query.size == 0) {
+      return std::unexpected(Error::INVALID_ARGUMENT);
     }
 
-    if (variable_sv == "isbn") {
-      if (auto opt_isbn = make_isbn(value_sv); opt_isbn.has_value()) {
-        record.isbn = *opt_isbn;
-        continue;
-      }
+    auto key = decode_page_token(query.order, query.token);
+    if (!key.has_value()) {
+      return std::unexpected(key.error());
+    }
+
+    PageRows rows;
+    auto const read_rows = [&](std::initializer_list<sql::Param> params) {
+      return read(ExecuteArgs{
+          .statement = statements[std::to_underlying(query.order)],
+          .params = params,
+          .callback = read_page_row,
+          .callback_arg = &rows,
+      });
+    };
 
-      return 1;
+    // Binding past the highest parameter a statement uses fails, so each
+    // statement gets only the leading parameters it needs.
+    auto const limit = static_cast<std::int64_t>(query.size) + 1;
+    std::expected<int, Error> result;
+    if (pattern.has_value()) {
+      result = read_rows({key->id, limit, std::string_view(key->key),
+                          key->isbn, *pattern});
+    } else if (query.order != Order::INSERTION) {
+      result =
+          read_rows({key->id, limit, std::string_view(key->key), key->isbn});
+    } else {
+      result = read_rows({key->id, limit});
     }
 
-    if (variable_sv == "name") {
-      record.name = value_sv;
-      continue;
+    if (!result.has_value()) {
+      return std::unexpected(result.error());
     }
 
-    if (variable_sv == "author") {
-      record.author = value_sv;
-      continue;
+    Page page{.records = std::move(rows.records)};
+    if (page.records.size() > query.size) {
+      page.records.resize(query.size);
+      auto const& last = page.records.back();
+      page.next_token = encode_page_token(
+          query.order,
+          PageKey{
+              .id = rows.ids[query.size - 1],
+              .isbn = static_cast<std::int64_t>(last.isbn.value()),
+              .key = query.order == Order::AUTHOR ? last.author : last.name,
+          });
     }
 
-    if (variable_sv == "acquired") {
-      if (int x; sscanf(value_sv.data(), "%d", &x)) {
-        record.acquired = x;
-        continue;
+    return page;
+  }
+
+  // Runs `statement` once for every UUID in a single transaction. An item
+  // fails with INVALID_ARGUMENT unless it changes exactly one row; under
+  // ALL_OR_NOTHING its failure rolls back the whole batch.
+  auto write_each(sql::Statement statement, std::span<UUID const> uuids,
+                  Batch batch) -> std::expected<Outcomes, Error> {
+    Outcomes outcomes;
+    auto result = write([&](Connection& writer) -> std::expected<void, Error> {
+      outcomes.clear();
+      outcomes.reserve(uuids.size());
+      for (std::size_t i = 0; i < uuids.size(); ++i) {
+        auto outcome =
+            writer
+                .execute_locked(ExecuteArgs{
+                    .statement = statement,
+                    .params = {sql::uuid_param(uuids[i])},
+                })
+                .and_then([](int changes) -> std::expected<void, Error> {
+                  if (changes == 1) {
+                    return {};
+                  }
+
+                  return std::unexpected(Error::INVALID_ARGUMENT);
+                });
+        if (!outcome.has_value() && batch == Batch::ALL_OR_NOTHING) {
+          log(std::format("item {} of {} failed; rolling back the batch", i,
+                          uuids.size()));
+          return std::unexpected(outcome.error());
+        }
+
+        outcomes.push_back(outcome);
       }
-      return 1;
+
+      return {};
+    });
+
+    if (!result.has_value()) {
+      return std::unexpected(result.error());
     }
 
-    return 1;
+    return outcomes;
   }
 
-  records.push_back(std::move(record));
-  return 0;
-}
+  // execute_acquisition for a batch. With an availability index the flags
+  // are flipped in memory first and only those that changed are written,
+  // all or none.
+  auto execute_acquisitions(sql::Statement statement,
+                            std::span<UUID const> uuids, Batch batch)
+      -> std::expected<Outcomes, Error> {
+    auto const acquired = statement == sql::Statement::ACQUIRE_RECORD;
+    if (availability_ == nullptr) {
+      return write_each(statement, uuids, batch)
+          .transform([&](Outcomes outcomes) {
+            for (std::size_t i = 0; i < uuids.size(); ++i) {
+              if (outcomes[i].has_value()) {
+                on_acquisition(uuids[i], acquired);
+              }
+            }
 
-static auto log(std::string_view message, const std::source_location location =
-                                              std::source_location::current()) {
-  /* clang-format off */
-  std::cerr << std::format("file={}:{} function={} message='{}'",
-                           location.file_name(),
-                           location.line(),
-                           location.function_name(),
-                           message) << std::endl;
-  /* clang-format on */
-}
+            return outcomes;
+          });
+    }
 
-using unique_sqlite3 =
-    std::unique_ptr<sqlite3,
-                    decltype([](sqlite3* db) -> void { sqlite3_close(db); })>;
+    if (deferred_ != nullptr && deferred_->failing()) {
+      log("deferred acquired flags are failing to commit");
+      return std::unexpected(Error::DB_CONNECTION);
+    }
 
-class Library::Impl {
-  unique_sqlite3 db_;
-  std::mutex db_mutex_;
+    Outcomes outcomes;
+    outcomes.reserve(uuids.size());
+    std::vector<UUID> flipped;
+    for (auto const& uuid : uuids) {
+      if (availability_->exchange(uuid, acquired)) {
+        outcomes.emplace_back();
+        flipped.push_back(uuid);
+      } else {
+        outcomes.push_back(std::unexpected(Error::INVALID_ARGUMENT));
+      }
+    }
 
- public:
-  explicit Impl(unique_sqlite3 db) : db_(std::move(db)) {}
+    auto const undo = [&] {
+      for (auto const& uuid : flipped) {
+        availability_->exchange(uuid, !acquired);
+      }
+    };
 
-  struct ExecuteArgs {
-    std::string_view sql = meta::REQUIRED;
-    int (*callback)(void*, int, char**, char**) = nullptr;
-    void* callback_arg = nullptr;
-  };
+    if (batch == Batch::ALL_OR_NOTHING && flipped.size() != uuids.size()) {
+      undo();
+      return std::unexpected(Error::INVALID_ARGUMENT);
+    }
 
-  auto execute(ExecuteArgs args) -> std::expected<int, Error> {
-    char* errmsg;
-    std::lock_guard lk(db_mutex_);
-    if (db_.get() == nullptr) {
+    if (deferred_ == nullptr) {
+      auto written = write_each(statement, flipped, batch);
+      if (!written.has_value()) {
+        undo();
+        return std::unexpected(written.error());
+      }
+
+      // Items whose write failed get their flag back and report the error;
+      // written[j] is the outcome of the j-th flipped item.
+      for (std::size_t i = 0, j = 0; i < uuids.size(); ++i) {
+        if (!outcomes[i].has_value()) {
+          continue;
+        }
+
+        if (auto& outcome = (*written)[j++]; !outcome.has_value()) {
+          availability_->exchange(uuids[i], !acquired);
+          outcomes[i] = std::move(outcome);
+        }
+      }
+    }
+
+    for (std::size_t i = 0; i < uuids.size(); ++i) {
+      if (!outcomes[i].has_value()) {
+        continue;
+      }
+
+      if (deferred_ != nullptr) {
+        deferred_->push(uuids[i]);
+      }
+
+      on_acquisition(uuids[i], acquired);
+    }
+
+    return outcomes;
+  }
+
+  // Flips the acquired flag of a single record; anything else than exactly
+  // one changed row means the record does not exist or is already in the
+  // requested state. With an availability index the flag is flipped in
+  // memory first, so such calls fail without reaching the database.
+  auto execute_acquisition(sql::Statement statement, UUID uuid)
+      -> std::expected<void, Error> {
+    auto const acquired = statement == sql::Statement::ACQUIRE_RECORD;
+    if (deferred_ != nullptr && deferred_->failing()) {
+      log("deferred acquired flags are failing to commit");
       return std::unexpected(Error::DB_CONNECTION);
     }
 
-    if (sqlite3_exec(db_.get(),
-                     /* sql = */ args.sql.data(),
-                     /* callback = */ args.callback,
-                     /* callback_arg = */ args.callback_arg,
-                     /* errmsg = */ &errmsg)) {
-      log(errmsg);
-      sqlite3_free(errmsg);
-      return std::unexpected(Error::UNEXPECTED);
+    if (availability_ != nullptr) {
+      if (!availability_->exchange(uuid, acquired)) {
+        return std::unexpected(Error::INVALID_ARGUMENT);
+      }
+
+      if (deferred_ != nullptr) {
+        deferred_->push(uuid);
+        on_acquisition(uuid, acquired);
+        return {};
+      }
+    }
+
+    auto result = write([&](Connection& writer) {
+      return writer
+          .execute_locked(ExecuteArgs{
+              .statement = statement,
+              .params = {sql::uuid_param(uuid)},
+          })
+          .and_then([](int changes) -> std::expected<void, Error> {
+            if (changes == 1) {
+              return {};
+            }
+
+            return std::unexpected(Error::INVALID_ARGUMENT);
+          });
+    });
+
+    if (!result.has_value()) {
+      if (availability_ != nullptr) {
+        availability_->exchange(uuid, !acquired);
+      }
+    } else {
+      on_acquisition(uuid, acquired);
     }
 
-    return sqlite3_changes(db_.get());
+    return result;
   }
 };
 
@@ -215,50 +2752,286 @@ auto Library::operator=(Library&& that) noexcept -> Library& {
 
 Library::~Library() {}
 
-auto make_library(std::string_view path)
-    -> std::expected<Library, Library::Error> {
-  sqlite3* db;
-  if (sqlite3_open(path.data(), &db)) {
-    log(sqlite3_errmsg(db));
+Library::Cursor::Cursor(std::unique_ptr<CursorState> state)
+    : state_(std::move(state)) {}
+
+Library::Cursor::Cursor(Cursor&&) noexcept = default;
+
+auto Library::Cursor::operator=(Cursor&&) noexcept -> Cursor& = default;
+
+Library::Cursor::~Cursor() {}
+
+auto Library::Cursor::error() const -> std::optional<Error> {
+  return state_->error();
+}
+
+auto Library::Cursor::Iterator::operator*() const -> RecordView const& {
+  return cursor_->state_->current();
+}
+
+auto Library::Cursor::Iterator::operator++() -> Iterator& {
+  cursor_->state_->advance();
+  return *this;
+}
+
+auto Library::Cursor::Iterator::operator==(std::default_sentinel_t) const
+    -> bool {
+  return cursor_->state_->done();
+}
+
+// uuid_to_blob(text) converts the textual UUID keys of older schemas during
+// migrations; malformed input yields NULL.
+static auto sql_uuid_to_blob(sqlite3_context* context, int /* argc */,
+                             sqlite3_value** argv) -> void {
+  auto const* text =
+      reinterpret_cast<char const*>(sqlite3_value_text(argv[0]));
+  auto opt_uuid_string =
+      text == nullptr ? std::nullopt : make_uuid_string(text);
+  if (!opt_uuid_string.has_value()) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto const uuid = static_cast<UUID>(*opt_uuid_string);
+  sqlite3_result_blob(context, uuid.data(), static_cast<int>(uuid.size()),
+                      SQLITE_TRANSIENT);
+}
+
+// isbn_to_integer(text) converts textual ISBNs of older schemas to their
+// ISBN-13 integer during migrations, or NULL when the text is not a valid
+// ISBN.
+static auto sql_isbn_to_integer(sqlite3_context* context, int /* argc */,
+                                sqlite3_value** argv) -> void {
+  auto const* text =
+      reinterpret_cast<char const*>(sqlite3_value_text(argv[0]));
+  auto opt_isbn = make_isbn(text == nullptr ? "" : text);
+  if (!opt_isbn.has_value()) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  sqlite3_result_int64(context, static_cast<sqlite3_int64>(opt_isbn->value()));
+}
+
+// Brings the schema up to date. Runs under BEGIN IMMEDIATE so concurrent
+// openers of the same file apply each migration exactly once.
+static auto migrate(Connection& writer) -> std::expected<void, Library::Error> {
+  if (writer.handle() == nullptr) {
+    return std::unexpected(Library::Error::DB_CONNECTION);
+  }
+
+  if (sqlite3_create_function_v2(writer.handle(), "uuid_to_blob", 1,
+                                 SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                 sql_uuid_to_blob, nullptr, nullptr,
+                                 nullptr) ||
+      sqlite3_create_function_v2(writer.handle(), "isbn_to_integer", 1,
+                                 SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                 sql_isbn_to_integer, nullptr, nullptr,
+                                 nullptr)) {
+    log(sqlite3_errmsg(writer.handle()));
     return std::unexpected(Library::Error::UNEXPECTED);
   }
 
-  auto impl = std::make_unique<Library::Impl>(unique_sqlite3(db));
-  return impl->execute(Library::Impl::ExecuteArgs{.sql = sql::INIT_DB_SQL})
-      .transform([impl = std::move(impl)](int /* n affected rows */) mutable {
-        return Library(std::move(impl));
+  return writer.transaction(
+      [](Connection& connection) -> std::expected<void, Library::Error> {
+        std::size_t version = 0;
+        if (auto result = connection.execute_locked(Connection::ExecuteArgs{
+                .statement = sql::Statement::USER_VERSION,
+                .callback = read_count,
+                .callback_arg = &version,
+            });
+            !result.has_value()) {
+          return std::unexpected(result.error());
+        }
+
+        for (; version < sql::MIGRATIONS.size(); ++version) {
+          auto result =
+              connection.execute_script_locked(sql::MIGRATIONS[version])
+                  .and_then([&] {
+                    return connection.execute_script_locked(
+                        sql::make_set_user_version_sql(version + 1));
+                  });
+          if (!result.has_value()) {
+            return result;
+          }
+        }
+
+        return {};
       });
 }
 
+static auto open_connection(std::string_view path, int flags)
+    -> std::expected<unique_sqlite3, Library::Error> {
+  sqlite3* db = nullptr;
+  // Connections are guarded by Connection::mutex_, so SQLite's own per
+  // connection mutex is redundant.
+  auto const rc = sqlite3_open_v2(std::string(path).c_str(), &db,
+                                  flags | SQLITE_OPEN_NOMUTEX, nullptr);
+  auto connection = unique_sqlite3(db);
+  if (rc) {
+    log(db == nullptr ? sqlite3_errstr(rc) : sqlite3_errmsg(db));
+    return std::unexpected(Library::Error::UNEXPECTED);
+  }
+
+  sqlite3_busy_timeout(db, BUSY_TIMEOUT_MS);
+  return connection;
+}
+
+// In-memory and temporary databases are private to the connection that
+// opened them and cannot be shared with a read pool.
+static auto is_private_database(std::string_view path) -> bool {
+  return path.empty() || path == ":memory:";
+}
+
+auto make_library(std::string_view path, Library::Options options)
+    -> std::expected<Library, Library::Error> {
+  auto writer =
+      open_connection(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+  if (!writer.has_value()) {
+    return std::unexpected(writer.error());
+  }
+
+  auto impl = std::make_unique<Library::Impl>(std::move(*writer),
+                                              options.uuid_version);
+  if (options.wal) {
+    if (auto wal = impl->writer().execute_script(sql::WAL_SQL);
+        !wal.has_value()) {
+      return std::unexpected(wal.error());
+    }
+  }
+
+  if (auto init = migrate(impl->writer()); !init.has_value()) {
+    return std::unexpected(init.error());
+  }
+
+  if (options.metrics || options.on_slow_query != nullptr) {
+    impl->enable_metrics(options.slow_query_threshold,
+                         std::move(options.on_slow_query));
+  }
+
+  if (options.record_cache_capacity != 0) {
+    impl->enable_cache(options.record_cache_capacity);
+  }
+
+  impl->set_change_log_retention(options.change_log_retention);
+
+  if (options.availability_index) {
+    if (auto loaded = impl->load_availability(options.durability);
+        !loaded.has_value()) {
+      return std::unexpected(loaded.error());
+    }
+  }
+
+  if (options.group_commit) {
+    impl->enable_group_commit(options.group_commit_batch_size,
+                              options.group_commit_latency);
+  }
+
+  if (!is_private_database(path)) {
+    for (std::size_t i = 0; i < options.read_connections; ++i) {
+      auto reader = open_connection(path, SQLITE_OPEN_READONLY);
+      if (!reader.has_value()) {
+        return std::unexpected(reader.error());
+      }
+
+      impl->add_reader(std::move(*reader));
+    }
+  }
+
+  return Library(std::move(impl));
+}
+
 auto Library::insert(Book const& book) -> std::expected<UUID, Error> {
-  Record rec{.uuid = UUID{},
-             .isbn = book.isbn,
-             .name = book.name,
-             .author = book.author,
-             .acquired = false};
-  return pimpl_
-      ->execute(Impl::ExecuteArgs{
-          .sql = sql::make_insert_sql(rec),
-      })
-      .transform([uuid = rec.uuid](int /* n affected rows */) -> UUID {
-        return uuid;
-      });
+  auto const uuid = pimpl_->make_uuid();
+  return pimpl_->insert(std::span(&uuid, 1), std::span(&book, 1))
+      .transform([&uuid] { return uuid; });
+}
+
+auto Library::insert_many(std::span<Book const> books)
+    -> std::expected<std::vector<UUID>, Error> {
+  if (books.empty()) {
+    return std::vector<UUID>{};
+  }
+
+  std::vector<UUID> uuids;
+  uuids.reserve(books.size());
+  for (std::size_t i = 0; i < books.size(); ++i) {
+    uuids.push_back(pimpl_->make_uuid());
+  }
+
+  return pimpl_->insert(uuids, books).transform([&uuids] {
+    return std::move(uuids);
+  });
+}
+
+auto Library::insert_many(std::span<Book const> books, Batch batch)
+    -> std::expected<Insertions, Error> {
+  if (books.empty()) {
+    return Insertions{};
+  }
+
+  if (batch == Batch::ALL_OR_NOTHING) {
+    return insert_many(books).transform([](std::vector<UUID> uuids) {
+      return Insertions(uuids.begin(), uuids.end());
+    });
+  }
+
+  std::vector<UUID> uuids;
+  uuids.reserve(books.size());
+  for (std::size_t i = 0; i < books.size(); ++i) {
+    uuids.push_back(pimpl_->make_uuid());
+  }
+
+  return pimpl_->insert_each(uuids, books);
+}
+
+auto Library::insert_with(std::span<UUID const> uuids,
+                          std::span<Book const> books)
+    -> std::expected<void, Error> {
+  if (books.empty()) {
+    return {};
+  }
+
+  return pimpl_->insert(uuids, books);
 }
 
 auto Library::erase(UUID uuid) -> std::expected<void, Error> {
   return pimpl_
-      ->execute(Impl::ExecuteArgs{
-          .sql = sql::make_erase_sql(uuid),
+      ->write([uuid](Connection& writer) {
+        return writer
+            .execute_locked(Impl::ExecuteArgs{
+                .statement = sql::Statement::ERASE,
+                .params = {sql::uuid_param(uuid)},
+            })
+            .transform([](int /* n affected rows */) {});
       })
-      .transform([](int /* n affected rows */) {});
+      .transform([this, uuid] { pimpl_->on_erased(uuid); });
+}
+
+auto Library::erase_many(std::span<UUID const> uuids, Batch batch)
+    -> std::expected<Outcomes, Error> {
+  if (uuids.empty()) {
+    return Outcomes{};
+  }
+
+  return pimpl_->write_each(sql::Statement::ERASE, uuids, batch)
+      .transform([this, uuids](Outcomes outcomes) {
+        for (std::size_t i = 0; i < uuids.size(); ++i) {
+          if (outcomes[i].has_value()) {
+            pimpl_->on_erased(uuids[i]);
+          }
+        }
+
+        return outcomes;
+      });
 }
 
 auto Library::size() const -> std::expected<std::size_t, Error> {
   std::size_t count;
   return pimpl_
-      ->execute(Impl::ExecuteArgs{
-          .sql = sql::COUNT_SQL,
-          .callback = parse_count,
+      ->read(Impl::ExecuteArgs{
+          .statement = sql::Statement::COUNT,
+          .callback = read_count,
           .callback_arg = &count,
       })
       .transform(
@@ -268,63 +3041,186 @@ auto Library::size() const -> std::expected<std::size_t, Error> {
 auto Library::distinct() const -> std::expected<std::size_t, Error> {
   std::size_t count;
   return pimpl_
-      ->execute(Impl::ExecuteArgs{
-          .sql = sql::DISTINCT_SQL,
-          .callback = parse_count,
+      ->read(Impl::ExecuteArgs{
+          .statement = sql::Statement::DISTINCT,
+          .callback = read_count,
           .callback_arg = &count,
       })
       .transform(
           [count](int /* n affected rows */) -> std::size_t { return count; });
 }
 
-auto Library::fetch_records_generic(std::string_view sql) const
-    -> std::expected<std::vector<Record>, Error> {
-  std::vector<Record> records;
+auto Library::isbns() const -> std::expected<std::vector<ISBN>, Error> {
+  std::vector<ISBN> isbns;
   return pimpl_
-      ->execute(Impl::ExecuteArgs{
-          .sql = sql,
-          .callback = parse_record,
-          .callback_arg = &records,
+      ->read(Impl::ExecuteArgs{
+          .statement = sql::Statement::ISBNS,
+          .callback = read_isbn,
+          .callback_arg = &isbns,
       })
-      .transform([records_ptr = &records](int) -> std::vector<Record> {
-        return std::vector(std::move(*records_ptr));
+      .transform([&isbns](int /* n affected rows */) {
+        return std::move(isbns);
       });
 }
 
+auto Library::find(UUID uuid) const -> std::expected<Record, Error> {
+  return pimpl_->find(uuid);
+}
+
+auto Library::cache_stats() const -> CacheStats {
+  return pimpl_->cache_stats();
+}
+
+auto Library::metrics() const -> Metrics { return pimpl_->metrics(); }
+
+auto Library::Histogram::quantile(double q) const
+    -> std::chrono::microseconds {
+  auto const rank = static_cast<std::uint64_t>(
+      std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count)));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= std::max<std::uint64_t>(rank, 1)) {
+      return std::chrono::microseconds(std::uint64_t{1} << i);
+    }
+  }
+
+  return std::chrono::microseconds::zero();
+}
+
 auto Library::records() const -> std::expected<std::vector<Record>, Error> {
-  return fetch_records_generic(sql::RECORDS_SQL);
+  return pimpl_->fetch_records(Impl::ExecuteArgs{
+      .statement = sql::Statement::RECORDS,
+  });
+}
+
+auto Library::scan() const -> std::expected<Cursor, Error> {
+  return pimpl_->open_cursor(sql::Statement::RECORDS)
+      .transform([](std::unique_ptr<CursorState> state) {
+        return Cursor(std::move(state));
+      });
 }
 
 auto Library::name_like(std::string_view name_like)
     -> std::expected<std::vector<Record>, Error> {
-  return fetch_records_generic(sql::make_name_like_sql(name_like));
+  return pimpl_->fetch_records(Impl::ExecuteArgs{
+      .statement = sql::Statement::NAME_LIKE,
+      .params = {name_like},
+  });
 }
 
 auto Library::author_like(std::string_view author_like)
     -> std::expected<std::vector<Record>, Error> {
-  return fetch_records_generic(sql::make_author_like_sql(author_like));
+  return pimpl_->fetch_records(Impl::ExecuteArgs{
+      .statement = sql::Statement::AUTHOR_LIKE,
+      .params = {author_like},
+  });
 }
 
-auto Library::acquisition_generic_sql(std::string_view sql) const
-    -> std::expected<void, Error> {
-  return pimpl_->execute(Impl::ExecuteArgs{.sql = sql})
-      .and_then([](int changes) -> std::expected<void, Error> {
-        if (changes == 1) {
-          return {};
-        }
+auto Library::scan_name_like(std::string_view name_like) const
+    -> std::expected<Cursor, Error> {
+  return pimpl_->open_cursor(sql::Statement::NAME_LIKE, std::string(name_like))
+      .transform([](std::unique_ptr<CursorState> state) {
+        return Cursor(std::move(state));
+      });
+}
 
-        return std::unexpected(Error::INVALID_ARGUMENT);
+auto Library::scan_author_like(std::string_view author_like) const
+    -> std::expected<Cursor, Error> {
+  return pimpl_
+      ->open_cursor(sql::Statement::AUTHOR_LIKE, std::string(author_like))
+      .transform([](std::unique_ptr<CursorState> state) {
+        return Cursor(std::move(state));
       });
 }
 
+auto Library::records_page(PageQuery const& query) const
+    -> std::expected<Page, Error> {
+  return pimpl_->fetch_page(
+      {sql::Statement::RECORDS_PAGE, sql::Statement::RECORDS_BY_NAME_PAGE,
+       sql::Statement::RECORDS_BY_AUTHOR_PAGE},
+      query, std::nullopt);
+}
+
+auto Library::name_like_page(std::string_view name_like,
+                             PageQuery const& query) const
+    -> std::expected<Page, Error> {
+  return pimpl_->fetch_page(
+      {sql::Statement::NAME_LIKE_PAGE, sql::Statement::NAME_LIKE_BY_NAME_PAGE,
+       sql::Statement::NAME_LIKE_BY_AUTHOR_PAGE},
+      query, name_like);
+}
+
+auto Library::author_like_page(std::string_view author_like,
+                               PageQuery const& query) const
+    -> std::expected<Page, Error> {
+  return pimpl_->fetch_page({sql::Statement::AUTHOR_LIKE_PAGE,
+                             sql::Statement::AUTHOR_LIKE_BY_NAME_PAGE,
+                             sql::Statement::AUTHOR_LIKE_BY_AUTHOR_PAGE},
+                            query, author_like);
+}
+
+auto Library::changes(std::uint64_t sequence, std::size_t limit) const
+    -> std::expected<std::vector<Change>, Error> {
+  return pimpl_->changes(sequence, limit);
+}
+
+auto Library::trim_changes(std::uint64_t sequence)
+    -> std::expected<void, Error> {
+  return pimpl_->write([sequence](Connection& writer) {
+    return writer
+        .execute_locked(Impl::ExecuteArgs{
+            .statement = sql::Statement::TRIM_CHANGES,
+            .params = {static_cast<std::int64_t>(sequence)},
+        })
+        .transform([](int /* n affected rows */) {});
+  });
+}
+
+auto Library::subscribe(ChangeHandler handler)
+    -> std::expected<Subscription, Error> {
+  return pimpl_->feed().subscribe(std::move(handler));
+}
+
+auto Library::unsubscribe(std::uint64_t id) -> void {
+  pimpl_->feed().unsubscribe(id);
+}
+
 auto Library::acquire_book(UUID uuid) -> std::expected<void, Error> {
-  return acquisition_generic_sql(
-      sql::make_acquire_record_sql(UUIDString(uuid)));
+  return pimpl_->execute_acquisition(sql::Statement::ACQUIRE_RECORD, uuid);
 }
 
 auto Library::release_book(UUID uuid) -> std::expected<void, Error> {
-  return acquisition_generic_sql(
-      sql::make_release_record_sql(UUIDString(uuid)));
+  return pimpl_->execute_acquisition(sql::Statement::RELEASE_RECORD, uuid);
+}
+
+auto Library::acquire_books(std::span<UUID const> uuids, Batch batch)
+    -> std::expected<Outcomes, Error> {
+  if (uuids.empty()) {
+    return Outcomes{};
+  }
+
+  return pimpl_->execute_acquisitions(sql::Statement::ACQUIRE_RECORD, uuids,
+                                      batch);
+}
+
+auto Library::release_books(std::span<UUID const> uuids, Batch batch)
+    -> std::expected<Outcomes, Error> {
+  if (uuids.empty()) {
+    return Outcomes{};
+  }
+
+  return pimpl_->execute_acquisitions(sql::Statement::RELEASE_RECORD, uuids,
+                                      batch);
+}
+
+auto Library::available_copies(ISBN isbn) const
+    -> std::expected<std::size_t, Error> {
+  return pimpl_->available_copies(isbn);
+}
+
+auto Library::acquire_any(ISBN isbn) -> std::expected<UUID, Error> {
+  return pimpl_->acquire_any(isbn);
 }
 
 }  // namespace tbrekalo
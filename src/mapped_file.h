@@ -0,0 +1,75 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace tbrekalo {
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+  void* data_ = MAP_FAILED;
+  std::size_t size_ = 0;
+
+  MappedFile(void* data, std::size_t size) : data_(data), size_(size) {}
+
+ public:
+  // `advice` is passed to madvise, e.g. MADV_SEQUENTIAL for a single pass.
+  static auto open(std::string_view path, int advice = MADV_NORMAL)
+      -> std::optional<MappedFile> {
+    auto const fd = ::open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      return std::nullopt;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1) {
+      ::close(fd);
+      return std::nullopt;
+    }
+
+    auto const size = static_cast<std::size_t>(st.st_size);
+    auto* data = size == 0
+                     ? MAP_FAILED
+                     : ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (size != 0 && data == MAP_FAILED) {
+      return std::nullopt;
+    }
+
+    if (data != MAP_FAILED) {
+      ::madvise(data, size, advice);
+    }
+
+    return MappedFile(data, size);
+  }
+
+  MappedFile(MappedFile&& that) noexcept
+      : data_(std::exchange(that.data_, MAP_FAILED)),
+        size_(std::exchange(that.size_, 0)) {}
+
+  auto operator=(MappedFile&&) -> MappedFile& = delete;
+
+  ~MappedFile() {
+    if (data_ != MAP_FAILED) {
+      ::munmap(data_, size_);
+    }
+  }
+
+  auto view() const -> std::string_view {
+    if (data_ == MAP_FAILED) {
+      return {};
+    }
+
+    return std::string_view(static_cast<char const*>(data_), size_);
+  }
+};
+
+}  // namespace tbrekalo
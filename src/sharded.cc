@@ -0,0 +1,338 @@
+#include "tbrekalo/sharded.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <format>
+#include <functional>
+#include <iterator>
+#include <latch>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace tbrekalo {
+
+// Threads kept for the lifetime of a ShardedLibrary, one per shard but the
+// first, so fan-outs reuse them instead of starting threads per call.
+class ShardedLibrary::Workers {
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> jobs_;
+  bool stopping_ = false;
+  // Declared last so they start after, and are joined before, the members
+  // they use are destroyed.
+  std::vector<std::jthread> threads_;
+
+  auto run() -> void {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock lk(mutex_);
+        cv_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+
+      job();
+    }
+  }
+
+ public:
+  explicit Workers(std::size_t threads) {
+    for (std::size_t i = 0; i < threads; ++i) {
+      threads_.emplace_back([this] { run(); });
+    }
+  }
+
+  ~Workers() {
+    {
+      std::lock_guard lk(mutex_);
+      stopping_ = true;
+    }
+
+    cv_.notify_all();
+    threads_.clear();
+  }
+
+  // fn(i) for every i in [0, n), fn(0) on the caller's thread; returns once
+  // all have.
+  auto for_each(std::size_t n, std::function<void(std::size_t)> const& fn)
+      -> void {
+    std::latch done(static_cast<std::ptrdiff_t>(n - 1));
+    {
+      std::lock_guard lk(mutex_);
+      for (std::size_t i = 1; i < n; ++i) {
+        jobs_.emplace_back([&fn, &done, i] {
+          fn(i);
+          done.count_down();
+        });
+      }
+    }
+
+    cv_.notify_all();
+    fn(0);
+    done.wait();
+  }
+};
+
+template <class Fn>
+auto ShardedLibrary::fan_out(Fn const& fn) const
+    -> std::vector<std::invoke_result_t<Fn const&, std::size_t>> {
+  std::vector<std::optional<std::invoke_result_t<Fn const&, std::size_t>>>
+      results(shards_.size());
+  workers_->for_each(shards_.size(), [&results, &fn](std::size_t i) {
+    results[i].emplace(fn(i));
+  });
+
+  std::vector<std::invoke_result_t<Fn const&, std::size_t>> values;
+  values.reserve(results.size());
+  for (auto& result : results) {
+    values.push_back(*std::move(result));
+  }
+
+  return values;
+}
+
+// The values of all shards, or the error of the first shard that failed.
+template <class T>
+static auto collect(std::vector<std::expected<T, Library::Error>> results)
+    -> std::expected<std::vector<T>, Library::Error> {
+  std::vector<T> values;
+  values.reserve(results.size());
+  for (auto& result : results) {
+    if (!result.has_value()) {
+      return std::unexpected(result.error());
+    }
+
+    values.push_back(*std::move(result));
+  }
+
+  return values;
+}
+
+static auto sum(std::vector<std::size_t> const& counts) -> std::size_t {
+  return std::accumulate(counts.begin(), counts.end(), std::size_t{0});
+}
+
+static auto concat(std::vector<std::vector<Library::Record>> parts)
+    -> std::vector<Library::Record> {
+  std::vector<Library::Record> records;
+  records.reserve(std::accumulate(
+      parts.begin(), parts.end(), std::size_t{0},
+      [](std::size_t n, auto const& part) { return n + part.size(); }));
+  for (auto& part : parts) {
+    std::ranges::move(part, std::back_inserter(records));
+  }
+
+  return records;
+}
+
+static auto load_le64(unsigned char const* bytes) -> std::uint64_t {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < sizeof(value); ++i) {
+    value |= std::uint64_t{bytes[i]} << (8 * i);
+  }
+
+  return value;
+}
+
+// The shard holding `uuid`. Part of the on-disk format, since it decides
+// which file each copy lives in: the multiply-fold of std::hash<UUID> over
+// the UUID's bytes read as two little-endian words, modulo the shard count.
+// Unlike std::hash it reads the same on every host and standard library.
+static auto shard_index(UUID const& uuid, std::size_t shards) -> std::size_t {
+  auto const product =
+      static_cast<unsigned __int128>(load_le64(uuid.data()) ^
+                                     0x9E37'79B9'7F4A'7C15) *
+      (load_le64(uuid.data() + 8) ^ 0xD6E8'FEB8'6659'FD93);
+  return static_cast<std::size_t>(
+      static_cast<std::uint64_t>(product ^ (product >> 64)) % shards);
+}
+
+ShardedLibrary::ShardedLibrary(std::vector<Library> shards,
+                               UUIDVersion uuid_version)
+    : shards_(std::move(shards)),
+      uuid_version_(uuid_version),
+      workers_(std::make_unique<Workers>(shards_.size() - 1)) {}
+
+ShardedLibrary::ShardedLibrary(ShardedLibrary&&) noexcept = default;
+
+auto ShardedLibrary::operator=(ShardedLibrary&&) noexcept
+    -> ShardedLibrary& = default;
+
+ShardedLibrary::~ShardedLibrary() {}
+
+auto ShardedLibrary::shard(UUID const& uuid) -> Library& {
+  return shards_[shard_index(uuid, shards_.size())];
+}
+
+auto ShardedLibrary::shard(UUID const& uuid) const -> Library const& {
+  return shards_[shard_index(uuid, shards_.size())];
+}
+
+auto make_sharded_library(std::string_view path, std::size_t shards,
+                          Library::Options options)
+    -> std::expected<ShardedLibrary, Library::Error> {
+  auto const in_memory = path.empty() || path == ":memory:";
+
+  std::vector<Library> libraries;
+  libraries.reserve(std::max<std::size_t>(shards, 1));
+  for (std::size_t i = 0; i < std::max<std::size_t>(shards, 1); ++i) {
+    auto library = make_library(
+        in_memory ? std::string(path) : std::format("{}.{}", path, i), options);
+    if (!library.has_value()) {
+      return std::unexpected(library.error());
+    }
+
+    libraries.push_back(*std::move(library));
+  }
+
+  return ShardedLibrary(std::move(libraries), options.uuid_version);
+}
+
+auto ShardedLibrary::insert(Book const& book) -> std::expected<UUID, Error> {
+  auto const uuid = make_uuid(uuid_version_);
+  return shard(uuid)
+      .insert_with(std::span(&uuid, 1), std::span(&book, 1))
+      .transform([&uuid] { return uuid; });
+}
+
+auto ShardedLibrary::insert_many(std::span<Book const> books)
+    -> std::expected<std::vector<UUID>, InsertError> {
+  std::vector<UUID> uuids;
+  uuids.reserve(books.size());
+  std::vector<std::vector<UUID>> shard_uuids(shards_.size());
+  std::vector<std::vector<Book>> shard_books(shards_.size());
+  for (auto const& book : books) {
+    auto const uuid = make_uuid(uuid_version_);
+    auto const i = shard_index(uuid, shards_.size());
+    uuids.push_back(uuid);
+    shard_uuids[i].push_back(uuid);
+    shard_books[i].push_back(book);
+  }
+
+  auto const results = fan_out([&](std::size_t i) {
+    return shards_[i].insert_with(shard_uuids[i], shard_books[i]);
+  });
+
+  auto const failed = std::ranges::find_if(
+      results, [](auto const& result) { return !result.has_value(); });
+  if (failed == results.end()) {
+    return uuids;
+  }
+
+  InsertError error{.error = failed->error()};
+  for (std::size_t i = 0; i < shards_.size(); ++i) {
+    if (results[i].has_value()) {
+      for (auto const& uuid : shard_uuids[i]) {
+        if (!shards_[i].erase(uuid).has_value()) {
+          error.left_behind.push_back(uuid);
+        }
+      }
+    }
+  }
+
+  return std::unexpected(std::move(error));
+}
+
+auto ShardedLibrary::erase(UUID uuid) -> std::expected<void, Error> {
+  return shard(uuid).erase(uuid);
+}
+
+auto ShardedLibrary::size() const -> std::expected<std::size_t, Error> {
+  return collect(fan_out([this](std::size_t i) { return shards_[i].size(); }))
+      .transform(sum);
+}
+
+auto ShardedLibrary::distinct() const -> std::expected<std::size_t, Error> {
+  return collect(fan_out([this](std::size_t i) { return shards_[i].isbns(); }))
+      .transform([](std::vector<std::vector<ISBN>> parts) {
+        std::vector<ISBN> isbns;
+        for (auto const& part : parts) {
+          auto const middle =
+              isbns.insert(isbns.end(), part.begin(), part.end());
+          std::inplace_merge(isbns.begin(), middle, isbns.end());
+        }
+
+        return static_cast<std::size_t>(std::ranges::distance(
+            isbns.begin(), std::unique(isbns.begin(), isbns.end())));
+      });
+}
+
+auto ShardedLibrary::find(UUID uuid) const -> std::expected<Record, Error> {
+  return shard(uuid).find(uuid);
+}
+
+auto ShardedLibrary::cache_stats() const -> CacheStats {
+  CacheStats stats;
+  for (auto const& library : shards_) {
+    auto const shard_stats = library.cache_stats();
+    stats.hits += shard_stats.hits;
+    stats.misses += shard_stats.misses;
+  }
+
+  return stats;
+}
+
+auto ShardedLibrary::records() const
+    -> std::expected<std::vector<Record>, Error> {
+  return collect(
+             fan_out([this](std::size_t i) { return shards_[i].records(); }))
+      .transform(concat);
+}
+
+auto ShardedLibrary::name_like(std::string_view name_like)
+    -> std::expected<std::vector<Record>, Error> {
+  return collect(fan_out([this, name_like](std::size_t i) {
+           return shards_[i].name_like(name_like);
+         }))
+      .transform(concat);
+}
+
+auto ShardedLibrary::author_like(std::string_view author_like)
+    -> std::expected<std::vector<Record>, Error> {
+  return collect(fan_out([this, author_like](std::size_t i) {
+           return shards_[i].author_like(author_like);
+         }))
+      .transform(concat);
+}
+
+auto ShardedLibrary::acquire_book(UUID uuid) -> std::expected<void, Error> {
+  return shard(uuid).acquire_book(uuid);
+}
+
+auto ShardedLibrary::release_book(UUID uuid) -> std::expected<void, Error> {
+  return shard(uuid).release_book(uuid);
+}
+
+auto ShardedLibrary::available_copies(ISBN isbn) const
+    -> std::expected<std::size_t, Error> {
+  return collect(fan_out([this, isbn](std::size_t i) {
+           return shards_[i].available_copies(isbn);
+         }))
+      .transform(sum);
+}
+
+auto ShardedLibrary::acquire_any(ISBN isbn) -> std::expected<UUID, Error> {
+  auto const start = std::hash<ISBN>{}(isbn) % shards_.size();
+  for (std::size_t i = 0; i < shards_.size(); ++i) {
+    auto acquired = shards_[(start + i) % shards_.size()].acquire_any(isbn);
+    if (acquired.has_value() || acquired.error() != Error::INVALID_ARGUMENT) {
+      return acquired;
+    }
+  }
+
+  return std::unexpected(Error::INVALID_ARGUMENT);
+}
+
+}  // namespace tbrekalo
@@ -0,0 +1,585 @@
+#include "tbrekalo/snapshot.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "mapped_file.h"
+
+namespace tbrekalo {
+
+namespace snapshot {
+
+// A snapshot file is a header followed by the sections below, each starting
+// at a multiple of 8 bytes. Integers are little-endian; `n` is the record
+// count and records are numbered in insertion order.
+//
+//   UUIDS      n x 16 bytes
+//   ISBNS      n x u64, the ISBN-13 as a number
+//   NAMES      n x StringRef into HEAP
+//   AUTHORS    n x StringRef into HEAP
+//   ACQUIRED   n x u8
+//   HEAP       every distinct name and author once, not null-terminated
+//   HASH       2^hash_bits x u32 slots holding a record number + 1, or 0
+//              when empty; a UUID probes linearly from uuid_hash(uuid)
+//   BY_NAME    n x u32 record numbers ordered by name, ISBN, number
+//   BY_AUTHOR  n x u32 record numbers ordered by author, ISBN, number
+//   BY_ISBN    n x u32 record numbers ordered by ISBN, number
+enum Section : std::size_t {
+  UUIDS,
+  ISBNS,
+  NAMES,
+  AUTHORS,
+  ACQUIRED,
+  HEAP,
+  HASH,
+  BY_NAME,
+  BY_AUTHOR,
+  BY_ISBN,
+  SECTION_COUNT,
+};
+
+static constexpr std::array<char, 8> MAGIC = {'A', 'M', 'P', 'H',
+                                              'S', 'N', 'A', 'P'};
+static constexpr std::uint32_t VERSION = 1;
+
+// magic, version, hash_bits, records, distinct, then the offset and size of
+// every section.
+static constexpr std::size_t HEADER_SIZE =
+    8 + 4 + 4 + 8 + 8 + SECTION_COUNT * 16;
+
+static constexpr std::size_t UUID_SIZE = UUID::SourceSpan::extent;
+static constexpr std::size_t STRING_REF_SIZE = 8;
+
+struct StringRef {
+  std::uint32_t offset = 0;
+  std::uint32_t size = 0;
+};
+
+struct Layout {
+  std::uint32_t hash_bits = 0;
+  std::uint64_t records = 0;
+  std::uint64_t distinct = 0;
+  std::array<std::uint64_t, SECTION_COUNT> offsets{};
+  std::array<std::uint64_t, SECTION_COUNT> sizes{};
+};
+
+template <class T>
+static auto to_little_endian(T value) -> T {
+  if constexpr (std::endian::native == std::endian::big) {
+    return std::byteswap(value);
+  } else {
+    return value;
+  }
+}
+
+template <class T>
+static auto load(char const* src) -> T {
+  T value;
+  std::memcpy(&value, src, sizeof(value));
+  return to_little_endian(value);
+}
+
+template <class T>
+static auto store(std::ostream& out, T value) -> void {
+  value = to_little_endian(value);
+  out.write(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+// The multiply-fold of std::hash<UUID> over explicitly little-endian words,
+// so the HASH section reads the same on every host.
+static auto uuid_hash(char const* uuid) -> std::uint64_t {
+  auto const product =
+      static_cast<unsigned __int128>(load<std::uint64_t>(uuid) ^
+                                     0x9E37'79B9'7F4A'7C15) *
+      (load<std::uint64_t>(uuid + 8) ^ 0xD6E8'FEB8'6659'FD93);
+  return static_cast<std::uint64_t>(product ^ (product >> 64));
+}
+
+// Section sizes fixed by the record count; HEAP and HASH are given.
+static auto make_layout(std::uint64_t records, std::uint64_t heap_size,
+                        std::uint32_t hash_bits) -> Layout {
+  Layout layout{.hash_bits = hash_bits, .records = records};
+  layout.sizes = {
+      records * UUID_SIZE,       records * 8, records * STRING_REF_SIZE,
+      records * STRING_REF_SIZE, records,     heap_size,
+      (std::uint64_t{1} << hash_bits) * 4,  records * 4,
+      records * 4,               records * 4,
+  };
+
+  std::uint64_t offset = HEADER_SIZE;
+  for (std::size_t i = 0; i < SECTION_COUNT; ++i) {
+    offset = (offset + 7) & ~std::uint64_t{7};
+    layout.offsets[i] = offset;
+    offset += layout.sizes[i];
+  }
+
+  return layout;
+}
+
+}  // namespace snapshot
+
+auto write_snapshot(Library const& library, std::string_view path)
+    -> std::expected<void, SnapshotError> {
+  using namespace snapshot;
+
+  auto cursor = library.scan();
+  if (!cursor.has_value()) {
+    return std::unexpected(SnapshotError::LIBRARY);
+  }
+
+  std::vector<UUID> uuids;
+  std::vector<std::uint64_t> isbns;
+  std::vector<StringRef> names, authors;
+  std::vector<std::uint8_t> acquired;
+  std::string heap;
+  std::unordered_map<std::string, StringRef> interned;
+  auto const intern = [&](std::string_view str) -> std::optional<StringRef> {
+    auto [it, inserted] = interned.try_emplace(std::string(str));
+    if (inserted) {
+      if (heap.size() + str.size() > UINT32_MAX) {
+        return std::nullopt;
+      }
+
+      it->second = StringRef{
+          .offset = static_cast<std::uint32_t>(heap.size()),
+          .size = static_cast<std::uint32_t>(str.size()),
+      };
+      heap += str;
+    }
+
+    return it->second;
+  };
+
+  for (auto const& view : *cursor) {
+    auto name = intern(view.name);
+    auto author = intern(view.author);
+    if (!name.has_value() || !author.has_value() ||
+        uuids.size() == UINT32_MAX - 1) {
+      return std::unexpected(SnapshotError::MALFORMED);
+    }
+
+    uuids.push_back(view.uuid);
+    isbns.push_back(view.isbn.value());
+    names.push_back(*name);
+    authors.push_back(*author);
+    acquired.push_back(view.acquired ? 1 : 0);
+  }
+
+  if (cursor->error().has_value()) {
+    return std::unexpected(SnapshotError::LIBRARY);
+  }
+
+  auto const n = uuids.size();
+  auto const text = [&heap](StringRef ref) {
+    return std::string_view(heap).substr(ref.offset, ref.size);
+  };
+
+  auto make_order = [n](auto key) {
+    std::vector<std::uint32_t> order(n);
+    std::iota(order.begin(), order.end(), std::uint32_t{0});
+    std::ranges::sort(order, [&key](std::uint32_t lhs, std::uint32_t rhs) {
+      return key(lhs) < key(rhs);
+    });
+    return order;
+  };
+
+  auto const by_name = make_order([&](std::uint32_t i) {
+    return std::tuple(text(names[i]), isbns[i], i);
+  });
+  auto const by_author = make_order([&](std::uint32_t i) {
+    return std::tuple(text(authors[i]), isbns[i], i);
+  });
+  auto const by_isbn =
+      make_order([&](std::uint32_t i) { return std::pair(isbns[i], i); });
+
+  auto const slots = std::bit_ceil(std::max<std::uint64_t>(2 * n, 1));
+  std::vector<std::uint32_t> hash(slots, 0);
+  for (std::uint32_t i = 0; i < n; ++i) {
+    auto slot = uuid_hash(reinterpret_cast<char const*>(uuids[i].data())) &
+                (slots - 1);
+    while (hash[slot] != 0) {
+      slot = (slot + 1) & (slots - 1);
+    }
+
+    hash[slot] = i + 1;
+  }
+
+  auto layout = make_layout(
+      n, heap.size(), static_cast<std::uint32_t>(std::countr_zero(slots)));
+  for (std::size_t k = 0; k < n; ++k) {
+    layout.distinct +=
+        k == 0 || isbns[by_isbn[k]] != isbns[by_isbn[k - 1]] ? 1 : 0;
+  }
+
+  auto const tmp_path = std::string(path) + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(MAGIC.data(), MAGIC.size());
+    store(out, VERSION);
+    store(out, layout.hash_bits);
+    store(out, layout.records);
+    store(out, layout.distinct);
+    for (std::size_t i = 0; i < SECTION_COUNT; ++i) {
+      store(out, layout.offsets[i]);
+      store(out, layout.sizes[i]);
+    }
+
+    auto const seek = [&out, &layout](Section section) {
+      while (static_cast<std::uint64_t>(out.tellp()) <
+             layout.offsets[section]) {
+        out.put('\0');
+      }
+    };
+
+    auto const store_all = [&out](auto const& values) {
+      for (auto const value : values) {
+        store(out, value);
+      }
+    };
+
+    seek(UUIDS);
+    for (auto const& uuid : uuids) {
+      out.write(reinterpret_cast<char const*>(uuid.data()), UUID_SIZE);
+    }
+
+    seek(ISBNS);
+    store_all(isbns);
+    for (auto const section : {NAMES, AUTHORS}) {
+      seek(section);
+      for (auto const ref : section == NAMES ? names : authors) {
+        store(out, ref.offset);
+        store(out, ref.size);
+      }
+    }
+
+    seek(ACQUIRED);
+    store_all(acquired);
+    seek(HEAP);
+    out.write(heap.data(), static_cast<std::streamsize>(heap.size()));
+    seek(HASH);
+    store_all(hash);
+    seek(BY_NAME);
+    store_all(by_name);
+    seek(BY_AUTHOR);
+    store_all(by_author);
+    seek(BY_ISBN);
+    store_all(by_isbn);
+
+    out.close();
+    if (out.fail()) {
+      std::filesystem::remove(tmp_path);
+      return std::unexpected(SnapshotError::IO);
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, std::string(path), ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path);
+    return std::unexpected(SnapshotError::IO);
+  }
+
+  return {};
+}
+
+class SnapshotLibrary::Impl {
+  MappedFile file_;
+  char const* base_;
+  snapshot::Layout layout_;
+
+  auto section(snapshot::Section which) const -> char const* {
+    return base_ + layout_.offsets[which];
+  }
+
+  auto text(snapshot::Section field, std::size_t i) const
+      -> std::optional<std::string_view> {
+    auto const* ref = section(field) + i * snapshot::STRING_REF_SIZE;
+    auto const offset = load_u32(ref);
+    auto const size = load_u32(ref + 4);
+    if (std::uint64_t{offset} + size > layout_.sizes[snapshot::HEAP]) {
+      return std::nullopt;
+    }
+
+    return std::string_view(section(snapshot::HEAP) + offset, size);
+  }
+
+  static auto load_u32(char const* src) -> std::uint32_t {
+    return snapshot::load<std::uint32_t>(src);
+  }
+
+  auto isbn_value(std::size_t i) const -> std::uint64_t {
+    return snapshot::load<std::uint64_t>(section(snapshot::ISBNS) + i * 8);
+  }
+
+  // The k-th record number of an order section; nullopt when it is out of
+  // range.
+  auto ordered(snapshot::Section order, std::size_t k) const
+      -> std::optional<std::size_t> {
+    auto const i = load_u32(section(order) + k * 4);
+    if (i >= layout_.records) {
+      return std::nullopt;
+    }
+
+    return i;
+  }
+
+ public:
+  Impl(MappedFile file, snapshot::Layout layout)
+      : file_(std::move(file)),
+        base_(file_.view().data()),
+        layout_(layout) {}
+
+  // Checks the header and that every section lies within the file; the
+  // sections themselves are not read.
+  static auto open(std::string_view path)
+      -> std::expected<std::unique_ptr<Impl>, SnapshotError> {
+    using namespace snapshot;
+
+    auto file = MappedFile::open(path);
+    if (!file.has_value()) {
+      return std::unexpected(SnapshotError::IO);
+    }
+
+    auto const bytes = file->view();
+    if (bytes.size() < HEADER_SIZE ||
+        !std::ranges::equal(bytes.substr(0, MAGIC.size()), MAGIC) ||
+        load<std::uint32_t>(bytes.data() + 8) != VERSION) {
+      return std::unexpected(SnapshotError::MALFORMED);
+    }
+
+    auto const hash_bits = load<std::uint32_t>(bytes.data() + 12);
+    auto const records = load<std::uint64_t>(bytes.data() + 16);
+    if (hash_bits >= 40 || records >= UINT32_MAX ||
+        (std::uint64_t{1} << hash_bits) <= records) {
+      return std::unexpected(SnapshotError::MALFORMED);
+    }
+
+    auto const* const sections = bytes.data() + 32;
+    auto layout = make_layout(
+        records, load<std::uint64_t>(sections + 16 * HEAP + 8), hash_bits);
+    layout.distinct = load<std::uint64_t>(bytes.data() + 24);
+    for (std::size_t i = 0; i < SECTION_COUNT; ++i) {
+      auto const offset = load<std::uint64_t>(sections + 16 * i);
+      auto const size = load<std::uint64_t>(sections + 16 * i + 8);
+      if (offset % 8 != 0 || size != layout.sizes[i] || size > bytes.size() ||
+          offset > bytes.size() - size) {
+        return std::unexpected(SnapshotError::MALFORMED);
+      }
+
+      layout.offsets[i] = offset;
+    }
+
+    return std::make_unique<Impl>(*std::move(file), layout);
+  }
+
+  auto size() const -> std::size_t { return layout_.records; }
+  auto distinct() const -> std::size_t { return layout_.distinct; }
+
+  auto view(std::size_t i) const -> std::expected<RecordView, Error> {
+    if (i >= layout_.records) {
+      return std::unexpected(Error::INVALID_ARGUMENT);
+    }
+
+    auto const isbn = make_isbn(isbn_value(i));
+    auto const name = text(snapshot::NAMES, i);
+    auto const author = text(snapshot::AUTHORS, i);
+    if (!isbn.has_value() || !name.has_value() || !author.has_value()) {
+      return std::unexpected(Error::UNEXPECTED);
+    }
+
+    return RecordView{
+        .uuid = UUID(UUID::SourceSpan(
+            reinterpret_cast<unsigned char const*>(section(snapshot::UUIDS)) +
+                i * snapshot::UUID_SIZE,
+            snapshot::UUID_SIZE)),
+        .isbn = *isbn,
+        .name = *name,
+        .author = *author,
+        .acquired = section(snapshot::ACQUIRED)[i] != 0,
+    };
+  }
+
+  auto record(std::size_t i) const -> std::expected<Record, Error> {
+    return view(i).transform([](RecordView const& view) {
+      return Record{
+          .uuid = view.uuid,
+          .isbn = view.isbn,
+          .name = std::string(view.name),
+          .author = std::string(view.author),
+          .acquired = view.acquired,
+      };
+    });
+  }
+
+  auto find(UUID const& uuid) const -> std::expected<Record, Error> {
+    auto const* const key = reinterpret_cast<char const*>(uuid.data());
+    auto const mask = (std::uint64_t{1} << layout_.hash_bits) - 1;
+    auto slot = snapshot::uuid_hash(key) & mask;
+    for (std::uint64_t probes = 0; probes <= mask; ++probes) {
+      auto const entry = load_u32(section(snapshot::HASH) + slot * 4);
+      if (entry == 0) {
+        break;
+      }
+
+      if (entry > layout_.records) {
+        return std::unexpected(Error::UNEXPECTED);
+      }
+
+      if (std::memcmp(section(snapshot::UUIDS) +
+                          (entry - 1) * snapshot::UUID_SIZE,
+                      key, snapshot::UUID_SIZE) == 0) {
+        return record(entry - 1);
+      }
+
+      slot = (slot + 1) & mask;
+    }
+
+    return std::unexpected(Error::INVALID_ARGUMENT);
+  }
+
+  auto records(Order order) const -> std::expected<std::vector<Record>, Error> {
+    auto const by = order == Order::NAME     ? snapshot::BY_NAME
+                    : order == Order::AUTHOR ? snapshot::BY_AUTHOR
+                                             : snapshot::SECTION_COUNT;
+    std::vector<Record> records;
+    records.reserve(layout_.records);
+    for (std::size_t k = 0; k < layout_.records; ++k) {
+      auto const i = by == snapshot::SECTION_COUNT
+                         ? std::optional<std::size_t>(k)
+                         : ordered(by, k);
+      if (!i.has_value()) {
+        return std::unexpected(Error::UNEXPECTED);
+      }
+
+      auto record = this->record(*i);
+      if (!record.has_value()) {
+        return std::unexpected(record.error());
+      }
+
+      records.push_back(*std::move(record));
+    }
+
+    return records;
+  }
+
+  // Records whose name or author contains `pattern`, ignoring ASCII case.
+  auto like(snapshot::Section field, std::string_view pattern) const
+      -> std::expected<std::vector<Record>, Error> {
+    auto const lower = [](char c) {
+      return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    };
+
+    std::vector<Record> records;
+    for (std::size_t i = 0; i < layout_.records; ++i) {
+      auto const value = text(field, i);
+      if (!value.has_value()) {
+        return std::unexpected(Error::UNEXPECTED);
+      }
+
+      if (!std::ranges::search(*value, pattern, {}, lower, lower).empty() ||
+          pattern.empty()) {
+        auto record = this->record(i);
+        if (!record.has_value()) {
+          return std::unexpected(record.error());
+        }
+
+        records.push_back(*std::move(record));
+      }
+    }
+
+    return records;
+  }
+
+  // Binary search over BY_ISBN for the first copy of `isbn`, then a scan of
+  // its copies.
+  auto available_copies(ISBN const& isbn) const
+      -> std::expected<std::size_t, Error> {
+    auto const isbn_at = [this](std::size_t k) {
+      auto const i = ordered(snapshot::BY_ISBN, k);
+      return i.has_value() ? isbn_value(*i) : UINT64_MAX;
+    };
+
+    auto k = *std::ranges::partition_point(
+        std::views::iota(std::size_t{0},
+                         static_cast<std::size_t>(layout_.records)),
+        [&](std::size_t j) { return isbn_at(j) < isbn.value(); });
+
+    // A valid ISBN never equals the UINT64_MAX of an out-of-range entry.
+    std::size_t available = 0;
+    for (; k < layout_.records && isbn_at(k) == isbn.value(); ++k) {
+      auto const i = *ordered(snapshot::BY_ISBN, k);
+      available += section(snapshot::ACQUIRED)[i] == 0 ? 1 : 0;
+    }
+
+    return available;
+  }
+};
+
+SnapshotLibrary::SnapshotLibrary(std::unique_ptr<Impl> impl)
+    : pimpl_(std::move(impl)) {}
+
+SnapshotLibrary::SnapshotLibrary(SnapshotLibrary&&) noexcept = default;
+
+auto SnapshotLibrary::operator=(SnapshotLibrary&&) noexcept
+    -> SnapshotLibrary& = default;
+
+SnapshotLibrary::~SnapshotLibrary() {}
+
+auto make_snapshot_library(std::string_view path)
+    -> std::expected<SnapshotLibrary, SnapshotError> {
+  auto impl = SnapshotLibrary::Impl::open(path);
+  if (!impl.has_value()) {
+    return std::unexpected(impl.error());
+  }
+
+  return SnapshotLibrary(*std::move(impl));
+}
+
+auto SnapshotLibrary::size() const -> std::size_t { return pimpl_->size(); }
+
+auto SnapshotLibrary::distinct() const -> std::size_t {
+  return pimpl_->distinct();
+}
+
+auto SnapshotLibrary::view(std::size_t i) const
+    -> std::expected<RecordView, Error> {
+  return pimpl_->view(i);
+}
+
+auto SnapshotLibrary::find(UUID uuid) const -> std::expected<Record, Error> {
+  return pimpl_->find(uuid);
+}
+
+auto SnapshotLibrary::records(Order order) const
+    -> std::expected<std::vector<Record>, Error> {
+  return pimpl_->records(order);
+}
+
+auto SnapshotLibrary::name_like(std::string_view name_like) const
+    -> std::expected<std::vector<Record>, Error> {
+  return pimpl_->like(snapshot::NAMES, name_like);
+}
+
+auto SnapshotLibrary::author_like(std::string_view author_like) const
+    -> std::expected<std::vector<Record>, Error> {
+  return pimpl_->like(snapshot::AUTHORS, author_like);
+}
+
+auto SnapshotLibrary::available_copies(ISBN isbn) const
+    -> std::expected<std::size_t, Error> {
+  return pimpl_->available_copies(isbn);
+}
+
+}  // namespace tbrekalo
@@ -1,17 +1,74 @@
 #include "tbrekalo/uuid.h"
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <sqlite3.h>
 #include <uuid/uuid.h>
 
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <future>
 #include <functional>
+#include <iterator>
+#include <random>
 #include <ranges>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "doctest/doctest.h"
+#include "tbrekalo/async.h"
+#include "tbrekalo/import.h"
 #include "tbrekalo/library.h"
+#include "tbrekalo/sharded.h"
+#include "tbrekalo/snapshot.h"
 
 namespace tb = tbrekalo;
 using namespace std::literals;
 
+// On-disk database file removed together with its journal side files.
+struct TempDatabase {
+  std::string path = std::format(
+      "{}/amphlib-{}.db", std::filesystem::temp_directory_path().string(),
+      std::string_view(tb::UUIDString(tb::UUID{})));
+
+  TempDatabase() = default;
+  TempDatabase(TempDatabase const&) = delete;
+  auto operator=(TempDatabase const&) -> TempDatabase& = delete;
+
+  ~TempDatabase() {
+    for (auto suffix : {"", "-wal", "-shm", "-journal"}) {
+      std::filesystem::remove(path + suffix);
+    }
+  }
+};
+
+// Column 0 of every row `sql` returns, read through a connection of its own.
+static auto query_column(std::string const& path, char const* sql)
+    -> std::vector<std::string> {
+  std::vector<std::string> values;
+  sqlite3* raw;
+  REQUIRE_EQ(sqlite3_open(path.c_str(), &raw), SQLITE_OK);
+  auto const rc = sqlite3_exec(
+      raw, sql,
+      [](void* arg, int /* argc */, char** argv, char** /* names */) {
+        static_cast<std::vector<std::string>*>(arg)->emplace_back(argv[0]);
+        return 0;
+      },
+      &values, nullptr);
+  sqlite3_close(raw);
+  REQUIRE_EQ(rc, SQLITE_OK);
+  return values;
+}
+
 static constexpr tb::Book BOOK_HAMLET{
     .isbn = *tb::make_isbn("9788027237142"),
     .name = "Hamlet",
@@ -36,9 +93,73 @@ TEST_SUITE("ISBN") {
                tb::ISBN::Error::INVALID_CHAR);
   }
 
+  TEST_CASE("ISBNChecksum") {
+    REQUIRE_EQ(tb::make_isbn("9781466835192").error(),
+               tb::ISBN::Error::INVALID_CHECKSUM);
+    REQUIRE_EQ(tb::make_isbn("0306406153").error(),
+               tb::ISBN::Error::INVALID_CHECKSUM);
+    REQUIRE_EQ(tb::make_isbn(std::uint64_t{9781466835192}).error(),
+               tb::ISBN::Error::INVALID_CHECKSUM);
+    REQUIRE_EQ(tb::make_isbn(std::uint64_t{306406152}).error(),
+               tb::ISBN::Error::INVALID_LENGTH);
+  }
+
+  TEST_CASE("ISBNPrefix") {
+    // Valid checksums, but not a Bookland prefix.
+    REQUIRE_EQ(tb::make_isbn("0000000000000").error(),
+               tb::ISBN::Error::INVALID_PREFIX);
+    REQUIRE_EQ(tb::make_isbn("0123456789012").error(),
+               tb::ISBN::Error::INVALID_PREFIX);
+    REQUIRE_EQ(tb::make_isbn(std::uint64_t{9770000000003}).error(),
+               tb::ISBN::Error::INVALID_PREFIX);
+    REQUIRE_EQ(*tb::make_isbn(tb::make_isbn("9790000000001")->value()),
+               *tb::make_isbn("9790000000001"));
+  }
+
   TEST_CASE("valid") {
-    REQUIRE_EQ(std::string_view(*tb::make_isbn(VALID_ISBN_STR)),
-               VALID_ISBN_STR);
+    auto const isbn = *tb::make_isbn(VALID_ISBN_STR);
+    REQUIRE_EQ(std::string_view(tb::ISBNString(isbn)), VALID_ISBN_STR);
+    REQUIRE_EQ(*tb::make_isbn(isbn.value()), isbn);
+    static_assert(tb::make_isbn(VALID_ISBN_STR)->value() == 9781466835191);
+  }
+
+  TEST_CASE("ISBN10") {
+    REQUIRE_EQ(*tb::make_isbn("0306406152"), *tb::make_isbn("9780306406157"));
+    REQUIRE_EQ(std::string_view(tb::ISBNString(*tb::make_isbn("080442957X"))),
+               "9780804429573");
+    REQUIRE_EQ(*tb::make_isbn("080442957x"), *tb::make_isbn("080442957X"));
+    REQUIRE_EQ(tb::make_isbn("97803064061X5").error(),
+               tb::ISBN::Error::INVALID_CHAR);
+  }
+
+  TEST_CASE("ISBNBatch") {
+    std::vector<std::string> sources = {
+        VALID_ISBN_STR, "0306406152",    "080442957X",     "080442957x",
+        "123",          "a123456789123", "9781466835192", "0306406153",
+        "97803064061X5", "0000000000000", "9790000000001",
+    };
+
+    // Every length and check digit, valid or not, in pairs and singles.
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> digit(0, 9);
+    for (int i = 0; i < 1'001; ++i) {
+      std::string source(i % 2 == 0 ? 13 : 10, '0');
+      for (auto& c : source) {
+        c = static_cast<char>('0' + digit(rng));
+      }
+      if (i % 7 == 0) {
+        source.back() = 'X';
+      }
+      sources.push_back(std::move(source));
+    }
+
+    std::vector<std::string_view> views(sources.begin(), sources.end());
+    std::vector<std::expected<tb::ISBN, tb::ISBN::Error>> isbns(views.size());
+    tb::make_isbns(views, isbns);
+    for (std::size_t i = 0; i < views.size(); ++i) {
+      CAPTURE(views[i]);
+      CHECK_EQ(isbns[i], tb::make_isbn(views[i]));
+    }
   }
 
   TEST_CASE("hash") {
@@ -50,6 +171,24 @@ TEST_SUITE("ISBN") {
             .size(),
         1uz);
   }
+
+  TEST_CASE("hashSpread") {
+    // Consecutive ISBNs differ only in their last digits.
+    static constexpr std::size_t BUCKETS = 64;
+    std::array<std::size_t, BUCKETS> load{};
+    for (std::uint64_t first_12 = 978'000'000'000;
+         first_12 < 978'000'000'000 + 64 * 1'024; ++first_12) {
+      std::uint64_t sum = 0, rest = first_12;
+      for (int i = 0; i < 12; ++i, rest /= 10) {
+        sum += (rest % 10) * (i % 2 == 0 ? 3 : 1);
+      }
+      auto const isbn = tb::make_isbn(first_12 * 10 + (10 - sum % 10) % 10);
+      REQUIRE(isbn.has_value());
+      ++load[std::hash<tb::ISBN>{}(*isbn) % BUCKETS];
+    }
+    CHECK_LT(std::ranges::max(load), 2 * 1'024);
+    CHECK_GT(std::ranges::min(load), 1'024 / 2);
+  }
 }
 
 TEST_SUITE("UUID") {
@@ -79,11 +218,100 @@ TEST_SUITE("UUID") {
     }
   }
 
+  TEST_CASE("UUIDBatch") {
+    std::vector<tb::UUID> uuids(33);
+    std::vector<std::string> strings;
+    for (std::size_t i = 0; i < uuids.size(); ++i) {
+      char str[37];
+      auto const unparse = i % 3 == 0 ? uuid_unparse_upper : uuid_unparse;
+      unparse(uuids[i].data(), str);
+      strings.emplace_back(str);
+    }
+
+    std::string serialized(36 * uuids.size(), '\0');
+    tb::serialize_uuids(uuids, serialized);
+    for (std::size_t i = 0; i < uuids.size(); ++i) {
+      CHECK_EQ(serialized.substr(36 * i, 36),
+               std::string_view(tb::UUIDString(uuids[i])));
+      CHECK(std::ranges::equal(serialized.substr(36 * i, 36),
+                               strings[i] | std::views::transform([](char c) {
+                                 return static_cast<char>(std::tolower(c));
+                               })));
+    }
+
+    std::vector<std::string_view> views(strings.begin(), strings.end());
+    std::vector<tb::UUID> parsed(uuids.size());
+    CHECK_EQ(tb::parse_uuids(views, parsed), uuids.size());
+    CHECK_EQ(parsed, uuids);
+
+    SUBCASE("IllFormed") {
+      strings[20][35] = 'g';
+      views[20] = strings[20];
+      CHECK_EQ(tb::parse_uuids(views, parsed), 20);
+
+      views[20] = views[20].substr(1);
+      CHECK_EQ(tb::parse_uuids(views, parsed), 20);
+
+      strings[7][8] = '0';
+      views[7] = strings[7];
+      CHECK_EQ(tb::parse_uuids(views, parsed), 7);
+    }
+  }
+
+  TEST_CASE("UUIDv7") {
+    auto const before = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+
+    std::vector<tb::UUID> uuids;
+    std::ranges::generate_n(std::back_inserter(uuids), 4096, tb::make_uuid_v7);
+    for (auto const& uuid : uuids) {
+      CHECK_EQ(uuid.data()[6] >> 4, 7);
+      CHECK_EQ(uuid.data()[8] & 0xC0, 0x80);
+    }
+
+    std::int64_t timestamp = 0;
+    for (int i = 0; i < 6; ++i) {
+      timestamp = (timestamp << 8) | uuids.front().data()[i];
+    }
+    CHECK_GE(timestamp, before);
+
+    // Strictly increasing, even within the same millisecond.
+    CHECK(std::ranges::adjacent_find(uuids, std::ranges::greater_equal{}) ==
+          uuids.end());
+  }
+
   TEST_CASE("UUIDHash") {
     tb::UUID a, b;
     REQUIRE(std::unordered_set<tb::UUID>{a, a, b}.size() == 2);
   }
 
+  TEST_CASE("UUIDHashSpread") {
+    // Sequential identifiers still spread evenly over power-of-two buckets.
+    static constexpr std::size_t BUCKETS = 64;
+    std::array<std::size_t, BUCKETS> load{};
+    for (int i = 0; i < 64 * 1'024; ++i) {
+      ++load[std::hash<tb::UUID>{}(tb::make_uuid_v7()) % BUCKETS];
+    }
+    CHECK_LT(std::ranges::max(load), 2 * 1'024);
+    CHECK_GT(std::ranges::min(load), 1'024 / 2);
+  }
+
+  TEST_CASE("UUIDHeterogeneousLookup") {
+    tb::UUID const uuid;
+    tb::UUIDString const str(uuid);
+    CHECK_EQ(std::hash<tb::UUIDString>{}(str), std::hash<tb::UUID>{}(uuid));
+
+    std::unordered_map<tb::UUID, int, tb::UUIDHash, tb::UUIDEqual> map{
+        {uuid, 1},
+        {tb::UUID{}, 2},
+    };
+    auto it = map.find(str);
+    REQUIRE(it != map.end());
+    CHECK_EQ(it->second, 1);
+    CHECK_FALSE(map.contains(tb::UUIDString(tb::UUID{})));
+  }
+
   TEST_CASE("UUIDString") {
     static constexpr std::string_view UUID4(
         "d99d53e1-b67c-438b-8420-63766d8f50d0");
@@ -101,6 +329,10 @@ TEST_SUITE("UUID") {
   TEST_CASE("UUIDStringIllFormed") {
     static constexpr std::string_view UUID4("d99d53e1-b67c-438b-8420");
     REQUIRE(!tb::make_uuid_string(UUID4).has_value());
+    REQUIRE(!tb::make_uuid_string("d99d53e1-b67c-438b-8420-63766d8f50dz")
+                 .has_value());
+    REQUIRE(!tb::make_uuid_string("d99d53e1b-67c-438b-8420-63766d8f50d0")
+                 .has_value());
   }
 }
 
@@ -145,6 +377,42 @@ TEST_SUITE("Library") {
     }
   }
 
+  TEST_CASE("LibraryReadPool") {
+    TempDatabase db;
+    auto library =
+        *tb::make_library(db.path, {.wal = true, .read_connections = 4});
+    auto const uuids = *library.insert_many(std::vector(64, BOOK_HAMLET));
+    CHECK(std::filesystem::exists(db.path + "-wal"));
+
+    std::atomic<bool> failed = false;
+    {
+      std::vector<std::jthread> threads;
+      for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] {
+          for (int j = 0; j < 64; ++j) {
+            auto size = library.size();
+            auto records = library.records();
+            if (!size.has_value() || *size != uuids.size() ||
+                !records.has_value() || records->size() != uuids.size()) {
+              failed = true;
+            }
+          }
+        });
+      }
+
+      threads.emplace_back([&] {
+        for (auto uuid : uuids) {
+          if (!library.acquire_book(uuid).has_value() ||
+              !library.release_book(uuid).has_value()) {
+            failed = true;
+          }
+        }
+      });
+    }
+
+    CHECK(!failed);
+  }
+
   TEST_CASE("LibraryInsert") {
     auto library = *tb::make_library(":memory:");
 
@@ -167,6 +435,143 @@ TEST_SUITE("Library") {
     assert_insertion(BOOK_SIDDHARTHA, 3, 2);
   }
 
+  TEST_CASE("LibraryISBNRoundTrip") {
+    auto library = *tb::make_library(":memory:");
+    // Every ISBN make_isbn accepts must read back from the database.
+    auto const isbns = std::array{*tb::make_isbn("9790000000001"),
+                                  *tb::make_isbn("0306406152")};
+    for (auto const& isbn : isbns) {
+      REQUIRE(library
+                  .insert(tb::Book{
+                      .isbn = isbn,
+                      .name = "Name",
+                      .author = "Author",
+                  })
+                  .has_value());
+    }
+
+    auto const records = library.records();
+    REQUIRE(records.has_value());
+    REQUIRE_EQ(records->size(), isbns.size());
+    for (std::size_t i = 0; i < isbns.size(); ++i) {
+      CHECK_EQ((*records)[i].isbn, isbns[i]);
+    }
+  }
+
+  TEST_CASE("LibraryCounters") {
+    auto library = *tb::make_library(":memory:");
+    auto const hamlet_uuids = *library.insert_many(std::vector(3, BOOK_HAMLET));
+    auto const siddhartha_uuid = *library.insert(BOOK_SIDDHARTHA);
+    CHECK_EQ(*library.size(), 4);
+    CHECK_EQ(*library.distinct(), 2);
+
+    REQUIRE(library.erase(hamlet_uuids[0]).has_value());
+    REQUIRE(library.erase(hamlet_uuids[1]).has_value());
+    CHECK_EQ(*library.size(), 2);
+    CHECK_EQ(*library.distinct(), 2);
+
+    REQUIRE(library.erase(siddhartha_uuid).has_value());
+    REQUIRE(library.erase(siddhartha_uuid).has_value());
+    CHECK_EQ(*library.size(), 1);
+    CHECK_EQ(*library.distinct(), 1);
+
+    REQUIRE(library.erase(hamlet_uuids[2]).has_value());
+    CHECK_EQ(*library.size(), 0);
+    CHECK_EQ(*library.distinct(), 0);
+  }
+
+  TEST_CASE("LibraryInsertMany") {
+    auto library = *tb::make_library(":memory:");
+
+    {
+      auto result = library.insert_many({});
+      REQUIRE(result.has_value());
+      CHECK(result->empty());
+    }
+
+    {
+      auto const books = std::array{BOOK_HAMLET, BOOK_HAMLET, BOOK_SIDDHARTHA};
+      auto result = library.insert_many(books);
+      REQUIRE(result.has_value());
+      REQUIRE_EQ(result->size(), books.size());
+
+      auto const uuids = std::unordered_set(result->begin(), result->end());
+      CHECK_EQ(uuids.size(), books.size());
+      CHECK_EQ(*library.size(), 3);
+      CHECK_EQ(*library.distinct(), 2);
+    }
+
+    {
+      auto moved_library(std::move(library));
+      auto result = library.insert_many(std::array{BOOK_HAMLET});
+      REQUIRE(!result.has_value());
+      CHECK_EQ(result.error(), tb::Library::Error::DB_CONNECTION);
+      CHECK_EQ(*moved_library.size(), 3);
+    }
+  }
+
+  TEST_CASE("LibraryInsertManyPerItem") {
+    using Batch = tb::Library::Batch;
+
+    // Makes the database refuse copies of books named "Rejected".
+    static constexpr auto REJECT_SQL = R"(
+      CREATE TRIGGER reject BEFORE INSERT ON copy
+      WHEN (SELECT name FROM book WHERE isbn = new.isbn) = 'Rejected'
+      BEGIN SELECT RAISE(ABORT, 'rejected'); END;
+    )";
+
+    TempDatabase db;
+    REQUIRE(tb::make_library(db.path).has_value());
+    {
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(db.path.c_str(), &raw), SQLITE_OK);
+      auto const rc =
+          sqlite3_exec(raw, REJECT_SQL, nullptr, nullptr, nullptr);
+      sqlite3_close(raw);
+      REQUIRE_EQ(rc, SQLITE_OK);
+    }
+
+    auto library = *tb::make_library(db.path);
+    auto const books = std::array{
+        BOOK_HAMLET,
+        tb::Book{
+            .isbn = BOOK_SIDDHARTHA.isbn,
+            .name = "Rejected",
+            .author = "Nobody",
+        },
+        BOOK_HAMLET,
+    };
+
+    CHECK_EQ(library.insert_many(books, Batch::ALL_OR_NOTHING).error(),
+             tb::Library::Error::UNEXPECTED);
+    CHECK_EQ(*library.size(), 0);
+
+    // The failing book is reported in its slot and the others commit.
+    auto const inserted = *library.insert_many(books, Batch::PER_ITEM);
+    REQUIRE_EQ(inserted.size(), books.size());
+    CHECK(inserted[0].has_value());
+    CHECK_EQ(inserted[1].error(), tb::Library::Error::UNEXPECTED);
+    CHECK(inserted[2].has_value());
+    CHECK_EQ(*library.size(), 2);
+    CHECK_EQ(*library.distinct(), 1);
+    CHECK_EQ(library.find(*inserted[2])->name, BOOK_HAMLET.name);
+  }
+
+  TEST_CASE("LibraryUUIDv7") {
+    auto library =
+        *tb::make_library(":memory:", {.uuid_version = tb::UUIDVersion::V7});
+    auto const uuids = *library.insert_many(std::array{
+        BOOK_HAMLET,
+        BOOK_SIDDHARTHA,
+        BOOK_HAMLET,
+    });
+
+    CHECK(std::ranges::is_sorted(uuids));
+    for (auto const& uuid : uuids) {
+      CHECK_EQ(uuid.data()[6] >> 4, 7);
+    }
+  }
+
   TEST_CASE("LibraryErase") {
     auto library = *tb::make_library(":memory:");
     auto hamlet = *library.insert(BOOK_HAMLET);
@@ -204,6 +609,83 @@ TEST_SUITE("Library") {
     }
   }
 
+  TEST_CASE("LibraryScan") {
+    static_assert(std::ranges::input_range<tb::Library::Cursor>);
+
+    auto library = *tb::make_library(":memory:");
+    auto hamlet = *library.insert(BOOK_HAMLET);
+    auto omlet = *library.insert(BOOK_HAMLET);
+    auto siddhartha = *library.insert(BOOK_SIDDHARTHA);
+
+    SUBCASE("All") {
+      auto cursor = library.scan();
+      REQUIRE(cursor.has_value());
+
+      std::unordered_set<tb::UUID> uuids, expected{hamlet, omlet, siddhartha};
+      for (auto const& record : *cursor) {
+        uuids.insert(record.uuid);
+      }
+
+      REQUIRE_EQ(uuids, expected);
+      REQUIRE(!cursor->error().has_value());
+
+      // An exhausted cursor no longer holds the connection.
+      CHECK_EQ(*library.size(), 3);
+    }
+
+    SUBCASE("Views") {
+      auto names = *library.scan() |
+                   std::views::filter([](auto const& record) {
+                     return record.author == BOOK_SIDDHARTHA.author;
+                   }) |
+                   std::views::transform([](auto const& record) {
+                     return std::string(record.name);
+                   });
+
+      std::vector<std::string> result;
+      for (auto&& name : names) {
+        result.push_back(std::move(name));
+      }
+
+      REQUIRE_EQ(result, std::vector<std::string>{BOOK_SIDDHARTHA.name});
+    }
+
+    SUBCASE("Like") {
+      auto authors = *library.scan_author_like("Shakespeare");
+      std::unordered_set<tb::UUID> uuids, expected{hamlet, omlet};
+      for (auto const& record : authors) {
+        uuids.insert(record.uuid);
+      }
+      REQUIRE_EQ(uuids, expected);
+
+      auto cursor = *library.scan_name_like("iddh");
+      auto it = cursor.begin();
+      REQUIRE(it != cursor.end());
+      CHECK((*it).uuid == siddhartha);
+      CHECK_EQ((*it).name, BOOK_SIDDHARTHA.name);
+      CHECK(++it == cursor.end());
+    }
+
+    SUBCASE("Reentrant") {
+      // The cursor holds the only connection; calls from the iterating
+      // thread fail rather than deadlock, and work again once it is done.
+      auto cursor = *library.scan();
+      auto it = cursor.begin();
+      REQUIRE(it != cursor.end());
+      CHECK_EQ(library.size().error(), tb::Library::Error::DB_CONNECTION);
+      CHECK_EQ(library.acquire_book(hamlet).error(),
+               tb::Library::Error::DB_CONNECTION);
+      CHECK_EQ(library.scan().error(), tb::Library::Error::DB_CONNECTION);
+
+      while (it != cursor.end()) {
+        ++it;
+      }
+
+      CHECK_EQ(*library.size(), 3);
+      CHECK(library.acquire_book(hamlet).has_value());
+    }
+  }
+
   TEST_CASE("LibraryLike") {
     auto library = *tb::make_library(":memory:");
 
@@ -237,6 +719,18 @@ TEST_SUITE("Library") {
       SUBCASE("Siddhartha") { assert_single("iddh", siddhartha_uuid); }
     }
 
+    SUBCASE("CaseInsensitive") {
+      auto assert_single = make_assert_single(&tb::Library::author_like);
+      assert_single("william", hamlet_uuid);
+    }
+
+    SUBCASE("Erased") {
+      REQUIRE(library.erase(hamlet_uuid).has_value());
+      auto result = library.author_like("William");
+      REQUIRE(result.has_value());
+      CHECK(result->empty());
+    }
+
     SUBCASE("Duplicate") {
       auto omlet_uuid = *library.insert(BOOK_HAMLET);
       auto result = library.author_like("William");
@@ -252,6 +746,575 @@ TEST_SUITE("Library") {
     }
   }
 
+  TEST_CASE("LibraryQuoting") {
+    auto library = *tb::make_library(":memory:");
+    auto const book = tb::Book{
+        .isbn = *tb::make_isbn("9780241129623"),
+        .name = "The Third Policeman",
+        .author = "Flann O'Brien",
+    };
+
+    auto uuid = library.insert(book);
+    REQUIRE(uuid.has_value());
+
+    auto result = library.author_like("O'Brien");
+    REQUIRE(result.has_value());
+    REQUIRE(result->size() == 1);
+    CHECK(result->front().uuid == *uuid);
+    CHECK_EQ(result->front().author, book.author);
+  }
+
+  TEST_CASE("LibraryMigrate") {
+    // Schema as created before migrations were introduced.
+    static constexpr auto UNVERSIONED_SQL = R"(
+      CREATE TABLE record(
+        uuid TEXT PRIMARY KEY,
+        isbn TEXT NOT NULL,
+        name TEXT NOT NULL,
+        author TEXT NOT NULL,
+        acquired INTEGER DEFAULT 0
+      );
+      INSERT INTO record VALUES(
+        'd99d53e1-b67c-438b-8420-63766d8f50d0',
+        '9788027237142', 'Hamlet', 'William Shakespeare', 1
+      );
+      INSERT INTO record VALUES(
+        '0b6e1d8f-3f0c-4a39-9a4e-1c7d7fd0f0a1',
+        '8027237149', 'Hamlet, Prince of Denmark', 'William Shakespeare', 0
+      );
+    )";
+
+    TempDatabase db;
+    {
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(db.path.c_str(), &raw), SQLITE_OK);
+      auto const rc = sqlite3_exec(raw, UNVERSIONED_SQL, nullptr, nullptr,
+                                   nullptr);
+      sqlite3_close(raw);
+      REQUIRE_EQ(rc, SQLITE_OK);
+    }
+
+    auto library = tb::make_library(db.path);
+    REQUIRE(library.has_value());
+
+    // Both spellings of Hamlet's ISBN end up as copies of one book.
+    auto result = library->name_like("aml");
+    REQUIRE(result.has_value());
+    REQUIRE_EQ(result->size(), 2);
+    CHECK_EQ(std::string_view(tb::UUIDString(result->front().uuid)),
+             "d99d53e1-b67c-438b-8420-63766d8f50d0");
+    CHECK(result->front().acquired);
+    CHECK_EQ(result->back().isbn, BOOK_HAMLET.isbn);
+    CHECK_EQ(*library->distinct(), 1);
+    CHECK_EQ(*library->available_copies(BOOK_HAMLET.isbn), 1);
+    CHECK(library->release_book(result->front().uuid).has_value());
+
+    // The copy whose name lost the merge keeps it on the side.
+    auto const conflicts =
+        query_column(db.path, "SELECT name FROM copy_conflicting_metadata;");
+    REQUIRE_EQ(conflicts.size(), 1);
+    CHECK_NE(conflicts.front(), result->front().name);
+
+    auto siddhartha = library->insert(BOOK_SIDDHARTHA);
+    REQUIRE(siddhartha.has_value());
+    CHECK_EQ(*library->size(), 3);
+    CHECK_EQ(library->author_like("Hesse")->size(), 1);
+  }
+
+  TEST_CASE("LibraryMigrateInvalidISBN") {
+    // Older schemas stored ISBNs unchecked: a bad checksum and a 13-digit
+    // ISBN without a 978/979 prefix next to a valid one.
+    static constexpr auto UNVERSIONED_SQL = R"(
+      CREATE TABLE record(
+        uuid TEXT PRIMARY KEY,
+        isbn TEXT NOT NULL,
+        name TEXT NOT NULL,
+        author TEXT NOT NULL,
+        acquired INTEGER DEFAULT 0
+      );
+      INSERT INTO record VALUES(
+        'd99d53e1-b67c-438b-8420-63766d8f50d0',
+        '9788027237142', 'Hamlet', 'William Shakespeare', 1
+      );
+      INSERT INTO record VALUES(
+        '0b6e1d8f-3f0c-4a39-9a4e-1c7d7fd0f0a1',
+        '9788027237143', 'Hamlet', 'William Shakespeare', 0
+      );
+      INSERT INTO record VALUES(
+        '5f0c8a2e-7d43-4b1e-9c6a-2e8b7d1f3a90',
+        '0000000000000', 'Unknown', 'Nobody', 1
+      );
+    )";
+
+    TempDatabase db;
+    {
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(db.path.c_str(), &raw), SQLITE_OK);
+      auto const rc = sqlite3_exec(raw, UNVERSIONED_SQL, nullptr, nullptr,
+                                   nullptr);
+      sqlite3_close(raw);
+      REQUIRE_EQ(rc, SQLITE_OK);
+    }
+
+    // The invalid rows are set aside and the rest of the catalog opens.
+    auto library = tb::make_library(db.path);
+    REQUIRE(library.has_value());
+    CHECK_EQ(*library->size(), 1);
+    CHECK_EQ(*library->distinct(), 1);
+    CHECK_EQ(library->records()->front().isbn, BOOK_HAMLET.isbn);
+
+    CHECK_EQ(query_column(db.path,
+                          "SELECT isbn FROM copy_invalid_isbn ORDER BY isbn;"),
+             std::vector<std::string>{"0000000000000", "9788027237143"});
+  }
+
+  TEST_CASE("LibraryAvailabilityIndex") {
+    TempDatabase db;
+    auto durability = tb::Library::Durability::SYNC;
+    SUBCASE("Sync") {}
+    SUBCASE("Deferred") { durability = tb::Library::Durability::DEFERRED; }
+
+    tb::UUID hamlet_uuid, siddhartha_uuid;
+    {
+      auto library = *tb::make_library(
+          db.path, {.availability_index = true, .durability = durability});
+      hamlet_uuid = *library.insert(BOOK_HAMLET);
+      siddhartha_uuid = library.insert_many(std::array{BOOK_SIDDHARTHA})
+                            ->front();
+
+      REQUIRE(library.acquire_book(hamlet_uuid).has_value());
+      CHECK_EQ(library.acquire_book(hamlet_uuid).error(),
+               tb::Library::Error::INVALID_ARGUMENT);
+      CHECK_EQ(library.release_book(siddhartha_uuid).error(),
+               tb::Library::Error::INVALID_ARGUMENT);
+      CHECK_EQ(library.acquire_book(tb::UUID{}).error(),
+               tb::Library::Error::INVALID_ARGUMENT);
+
+      REQUIRE(library.erase(siddhartha_uuid).has_value());
+      CHECK_EQ(library.acquire_book(siddhartha_uuid).error(),
+               tb::Library::Error::INVALID_ARGUMENT);
+
+      std::atomic<int> acquired = 0;
+      auto const uuid = *library.insert(BOOK_SIDDHARTHA);
+      {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 8; ++i) {
+          threads.emplace_back([&] {
+            if (library.acquire_book(uuid).has_value()) {
+              ++acquired;
+            }
+          });
+        }
+      }
+      CHECK_EQ(acquired, 1);
+      REQUIRE(library.release_book(uuid).has_value());
+    }
+
+    auto library = *tb::make_library(db.path, {.availability_index = true});
+    auto records = *library.records();
+    REQUIRE_EQ(records.size(), 2);
+    for (auto const& record : records) {
+      CHECK_EQ(record.acquired, record.uuid == hamlet_uuid);
+    }
+
+    CHECK_EQ(library.acquire_book(hamlet_uuid).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK(library.release_book(hamlet_uuid).has_value());
+  }
+
+  TEST_CASE("LibraryDeferredRetry") {
+    TempDatabase db;
+    tb::UUID hamlet_uuid, siddhartha_uuid;
+    auto siddhartha_acquired = false;
+    {
+      auto library = *tb::make_library(
+          db.path, {.availability_index = true,
+                    .durability = tb::Library::Durability::DEFERRED});
+      hamlet_uuid = *library.insert(BOOK_HAMLET);
+      siddhartha_uuid = *library.insert(BOOK_SIDDHARTHA);
+
+      // Another connection holds the write lock, so the batch fails once
+      // the busy timeout runs out.
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(db.path.c_str(), &raw), SQLITE_OK);
+      REQUIRE_EQ(sqlite3_exec(raw, "BEGIN IMMEDIATE;", nullptr, nullptr,
+                              nullptr),
+                 SQLITE_OK);
+      REQUIRE(library.acquire_book(hamlet_uuid).has_value());
+
+      auto flip = [&library, &siddhartha_uuid, &siddhartha_acquired] {
+        auto const result = siddhartha_acquired
+                                ? library.release_book(siddhartha_uuid)
+                                : library.acquire_book(siddhartha_uuid);
+        if (result.has_value()) {
+          siddhartha_acquired = !siddhartha_acquired;
+        }
+
+        return result;
+      };
+
+      // The failure is surfaced on later calls until the batch is written.
+      auto const deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(30);
+      auto failing = false;
+      while (!failing && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto const result = flip();
+        failing = !result.has_value() &&
+                  result.error() == tb::Library::Error::DB_CONNECTION;
+      }
+      CHECK(failing);
+
+      REQUIRE_EQ(sqlite3_exec(raw, "COMMIT;", nullptr, nullptr, nullptr),
+                 SQLITE_OK);
+      sqlite3_close(raw);
+
+      auto recovered = false;
+      while (!recovered && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        recovered = flip().has_value();
+      }
+      CHECK(recovered);
+    }
+
+    auto library = *tb::make_library(db.path);
+    CHECK(library.find(hamlet_uuid)->acquired);
+    CHECK_EQ(library.find(siddhartha_uuid)->acquired, siddhartha_acquired);
+  }
+
+  TEST_CASE("LibraryDeferredRace") {
+    TempDatabase db;
+    std::vector<tb::UUID> uuids;
+    std::vector<bool> expected;
+    {
+      auto library = *tb::make_library(
+          db.path, {.availability_index = true,
+                    .durability = tb::Library::Durability::DEFERRED});
+      for (int i = 0; i < 4; ++i) {
+        uuids.push_back(*library.insert(BOOK_HAMLET));
+      }
+
+      // Acquires and releases of one copy race, so the flag a flush writes
+      // must be the index's rather than whichever call queued it last.
+      std::atomic<int> flips = 0;
+      {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 8; ++i) {
+          threads.emplace_back([&library, &uuids, &flips, i] {
+            for (int j = 0; j < 500; ++j) {
+              auto const uuid = uuids[(i + j) % uuids.size()];
+              auto const result = (i + j) % 2 == 0
+                                      ? library.acquire_book(uuid)
+                                      : library.release_book(uuid);
+              if (result.has_value()) {
+                ++flips;
+              }
+            }
+          });
+        }
+      }
+      CHECK_GT(flips, 0);
+
+      for (auto const& uuid : uuids) {
+        expected.push_back(library.find(uuid)->acquired);
+      }
+    }
+
+    auto library = *tb::make_library(db.path, {});
+    for (std::size_t i = 0; i < uuids.size(); ++i) {
+      CHECK_EQ(library.find(uuids[i])->acquired, expected[i]);
+    }
+  }
+
+  TEST_CASE("LibraryFind") {
+    auto library = *tb::make_library(":memory:", {.record_cache_capacity = 16});
+    auto const hamlet_uuid = *library.insert(BOOK_HAMLET);
+
+    auto hamlet = library.find(hamlet_uuid);
+    REQUIRE(hamlet.has_value());
+    CHECK_EQ(hamlet->name, BOOK_HAMLET.name);
+    CHECK(!hamlet->acquired);
+    CHECK_EQ(library.find(tb::UUID{}).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+
+    SUBCASE("Hits") {
+      REQUIRE(library.find(hamlet_uuid).has_value());
+      auto const stats = library.cache_stats();
+      CHECK_EQ(stats.hits, 1);
+      CHECK_EQ(stats.misses, 2);
+    }
+
+    SUBCASE("Acquire") {
+      REQUIRE(library.acquire_book(hamlet_uuid).has_value());
+      CHECK(library.find(hamlet_uuid)->acquired);
+      REQUIRE(library.release_book(hamlet_uuid).has_value());
+      CHECK(!library.find(hamlet_uuid)->acquired);
+      CHECK_EQ(library.cache_stats().hits, 2);
+    }
+
+    SUBCASE("Erase") {
+      REQUIRE(library.erase(hamlet_uuid).has_value());
+      CHECK_EQ(library.find(hamlet_uuid).error(),
+               tb::Library::Error::INVALID_ARGUMENT);
+    }
+
+    SUBCASE("Evict") {
+      auto const uuids =
+          *library.insert_many(std::vector(256, BOOK_SIDDHARTHA));
+      for (auto const& uuid : uuids) {
+        REQUIRE(library.find(uuid).has_value());
+      }
+
+      auto const misses = library.cache_stats().misses;
+      REQUIRE(library.find(hamlet_uuid).has_value());
+      CHECK_EQ(library.cache_stats().misses, misses + 1);
+    }
+  }
+
+  TEST_CASE("LibraryCopies") {
+    auto options = tb::Library::Options{};
+    SUBCASE("Database") {}
+    SUBCASE("AvailabilityIndex") { options.availability_index = true; }
+
+    auto library = *tb::make_library(":memory:", options);
+    auto const hamlet_uuids = *library.insert_many(std::vector(3, BOOK_HAMLET));
+    library.insert(BOOK_SIDDHARTHA);
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 3);
+
+    std::unordered_set<tb::UUID> acquired;
+    for (int i = 0; i < 3; ++i) {
+      auto uuid = library.acquire_any(BOOK_HAMLET.isbn);
+      REQUIRE(uuid.has_value());
+      acquired.insert(*uuid);
+    }
+
+    CHECK_EQ(acquired.size(), 3);
+    CHECK_EQ(library.acquire_any(BOOK_HAMLET.isbn).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 0);
+    CHECK_EQ(*library.available_copies(BOOK_SIDDHARTHA.isbn), 1);
+
+    REQUIRE(library.release_book(hamlet_uuids[1]).has_value());
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 1);
+    CHECK_EQ(*library.acquire_any(BOOK_HAMLET.isbn), hamlet_uuids[1]);
+
+    auto const unknown = *tb::make_isbn("9781466835191");
+    CHECK_EQ(*library.available_copies(unknown), 0);
+    CHECK_EQ(library.acquire_any(unknown).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+  }
+
+  TEST_CASE("LibraryCatalog") {
+    std::size_t record_cache_capacity = 0;
+    SUBCASE("Uncached") {}
+    SUBCASE("Cached") { record_cache_capacity = 16; }
+
+    auto library = *tb::make_library(
+        ":memory:", {.record_cache_capacity = record_cache_capacity});
+    auto const hamlet_uuid = *library.insert(BOOK_HAMLET);
+    REQUIRE_EQ(library.find(hamlet_uuid)->name, BOOK_HAMLET.name);
+    REQUIRE(library.insert(BOOK_HAMLET).has_value());
+
+    // Copies share their book's name and author, fixed by the first copy.
+    CHECK_EQ(library
+                 .insert(tb::Book{
+                     .isbn = BOOK_HAMLET.isbn,
+                     .name = "The Tragedy of Hamlet, Prince of Denmark",
+                     .author = BOOK_HAMLET.author,
+                 })
+                 .error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK(library.name_like("Prince of Denmark")->empty());
+    CHECK_EQ(library.name_like("Hamlet")->size(), 2);
+    CHECK_EQ(*library.distinct(), 1);
+    CHECK_EQ(library.find(hamlet_uuid)->name, BOOK_HAMLET.name);
+
+    auto const inserted = *library.insert_many(
+        std::array{
+            tb::Book{
+                .isbn = BOOK_HAMLET.isbn,
+                .name = BOOK_HAMLET.name,
+                .author = "W. Shakespeare",
+            },
+            BOOK_HAMLET,
+        },
+        tb::Library::Batch::PER_ITEM);
+    REQUIRE_EQ(inserted.size(), 2);
+    CHECK_EQ(inserted[0].error(), tb::Library::Error::INVALID_ARGUMENT);
+    CHECK(inserted[1].has_value());
+    CHECK_EQ(library.find(hamlet_uuid)->author, BOOK_HAMLET.author);
+    CHECK_EQ(*library.size(), 3);
+  }
+
+  TEST_CASE("LibraryGroupCommit") {
+    TempDatabase db;
+    auto library = *tb::make_library(
+        db.path, {
+                     .wal = true,
+                     .group_commit = true,
+                     .group_commit_batch_size = 16,
+                     .group_commit_latency = std::chrono::milliseconds(1),
+                 });
+    auto const hamlet_uuid = *library.insert(BOOK_HAMLET);
+
+    std::atomic<int> acquisitions = 0;
+    std::atomic<bool> failed = false;
+    {
+      std::vector<std::jthread> threads;
+      for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&] {
+          // Only one acquisition succeeds; the others fail without
+          // affecting the inserts committed alongside them.
+          if (library.acquire_book(hamlet_uuid).has_value()) {
+            ++acquisitions;
+          }
+
+          for (int j = 0; j < 32; ++j) {
+            auto uuid = library.insert(BOOK_SIDDHARTHA);
+            if (!uuid.has_value() || !library.acquire_book(*uuid).has_value()) {
+              failed = true;
+            }
+          }
+        });
+      }
+    }
+
+    CHECK(!failed);
+    CHECK_EQ(acquisitions, 1);
+    CHECK_EQ(*library.size(), 1 + 8 * 32);
+    CHECK_EQ(*library.available_copies(BOOK_SIDDHARTHA.isbn), 0);
+
+    CHECK(library.erase(hamlet_uuid).has_value());
+    CHECK_EQ(library.find(hamlet_uuid).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+  }
+
+  TEST_CASE("LibraryPages") {
+    auto library = *tb::make_library(":memory:");
+    std::vector<tb::Book> books;
+    for (auto const& book : {BOOK_SIDDHARTHA, BOOK_HAMLET}) {
+      for (int i = 0; i < 3; ++i) {
+        books.push_back(book);
+      }
+    }
+    books.push_back(tb::Book{
+        .isbn = *tb::make_isbn("9780141439600"),
+        .name = "A Tale of Two Cities",
+        .author = "Charles Dickens",
+    });
+    REQUIRE(library.insert_many(books).has_value());
+
+    auto const read_all = [](auto fetch_page, tb::Library::Order order) {
+      std::vector<tb::Library::Record> records;
+      tb::Library::PageQuery query{.size = 2, .order = order};
+      for (;;) {
+        auto page = fetch_page(query);
+        REQUIRE(page.has_value());
+        CHECK(page->records.size() <= 2);
+        std::ranges::move(page->records, std::back_inserter(records));
+        if (page->next_token.empty()) {
+          return records;
+        }
+
+        query.token = std::move(page->next_token);
+      }
+    };
+
+    auto const records_page = [&library](auto const& query) {
+      return library.records_page(query);
+    };
+
+    auto by_insertion = read_all(records_page, tb::Library::Order::INSERTION);
+    auto const all = *library.records();
+    REQUIRE_EQ(by_insertion.size(), all.size());
+    for (std::size_t i = 0; i < all.size(); ++i) {
+      CHECK_EQ(by_insertion[i].uuid, all[i].uuid);
+    }
+
+    auto const names = [](auto const& records) {
+      std::vector<std::string> names;
+      for (auto const& record : records) {
+        names.push_back(record.name);
+      }
+      return names;
+    };
+
+    auto by_name = read_all(records_page, tb::Library::Order::NAME);
+    CHECK_EQ(names(by_name),
+             std::vector<std::string>{"A Tale of Two Cities", "Hamlet",
+                                      "Hamlet", "Hamlet", "Siddhartha",
+                                      "Siddhartha", "Siddhartha"});
+
+    auto by_author = read_all(records_page, tb::Library::Order::AUTHOR);
+    CHECK_EQ(by_author.front().author, "Charles Dickens");
+    CHECK_EQ(by_author.back().author, "William Shakespeare");
+
+    auto hamlet = read_all(
+        [&library](auto const& query) {
+          return library.name_like_page("aml", query);
+        },
+        tb::Library::Order::NAME);
+    CHECK_EQ(hamlet.size(), 3);
+
+    auto first = *library.records_page({.size = 2});
+    CHECK_EQ(library
+                 .records_page({.size = 2,
+                                .token = first.next_token,
+                                .order = tb::Library::Order::NAME})
+                 .error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK_EQ(library.records_page({.size = 0}).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+  }
+
+  TEST_CASE("LibraryMetrics") {
+    CHECK(tb::make_library(":memory:")->metrics().statements.empty());
+
+    std::vector<tb::Library::SlowQuery> slow;
+    auto library = *tb::make_library(
+        ":memory:", {
+                        .metrics = true,
+                        .slow_query_threshold = std::chrono::microseconds(1),
+                        .on_slow_query =
+                            [&slow](tb::Library::SlowQuery const& query) {
+                              slow.push_back(query);
+                            },
+                    });
+    std::vector<tb::Book> books(100, BOOK_HAMLET);
+    REQUIRE(library.insert_many(books).has_value());
+    REQUIRE_EQ(library.records()->size(), 100);
+
+    auto const is_records = [](std::string_view sql) {
+      return sql.find("FROM copy JOIN book") != std::string_view::npos;
+    };
+
+    auto const metrics = library.metrics();
+    auto const records = std::ranges::find_if(
+        metrics.statements,
+        [&](auto const& statement) { return is_records(statement.sql); });
+    REQUIRE(records != metrics.statements.end());
+    CHECK_EQ(records->calls, 1);
+    CHECK_EQ(records->rows, 100);
+    CHECK_EQ(records->errors, 0);
+    CHECK_EQ(records->lock_wait.count, 1);
+    CHECK_EQ(records->execute.count, 1);
+    CHECK(records->execute.quantile(0.5) > std::chrono::microseconds(0));
+
+    auto const inserts = std::ranges::count_if(
+        metrics.statements, [](auto const& statement) {
+          return statement.sql.find("INSERT INTO copy") !=
+                     std::string_view::npos &&
+                 statement.calls == 100;
+        });
+    CHECK_EQ(inserts, 1);
+
+    // Scanning 100 rows takes longer than the 1us threshold.
+    auto const slow_records = std::ranges::find_if(
+        slow, [&](auto const& query) { return is_records(query.sql); });
+    REQUIRE(slow_records != slow.end());
+    CHECK(slow_records->plan.find("SCAN") != std::string::npos);
+  }
+
   TEST_CASE("LibraryBorrow") {
     auto library = *tb::make_library(":memory:");
     auto hamlet_uuid = *library.insert(BOOK_HAMLET);
@@ -276,4 +1339,512 @@ TEST_SUITE("Library") {
       REQUIRE(result.has_value());
     }
   }
+
+  TEST_CASE("LibraryBatch") {
+    using Error = tb::Library::Error;
+    using Batch = tb::Library::Batch;
+
+    tb::Library::Options options;
+    SUBCASE("Statements") {}
+    SUBCASE("AvailabilityIndex") { options.availability_index = true; }
+
+    auto library = *tb::make_library(":memory:", options);
+    auto const uuids =
+        *library.insert_many(std::vector<tb::Book>(3, BOOK_HAMLET));
+    auto const missing = tb::UUID{};
+
+    auto const acquired =
+        *library.acquire_books(std::array{uuids[0], uuids[1]});
+    CHECK(std::ranges::all_of(
+        acquired, [](auto const& outcome) { return outcome.has_value(); }));
+
+    // Per item, copies already acquired fail alone.
+    auto const partial =
+        *library.acquire_books(std::array{uuids[1], uuids[2]});
+    REQUIRE_EQ(partial.size(), 2);
+    CHECK_EQ(partial[0].error(), Error::INVALID_ARGUMENT);
+    CHECK(partial[1].has_value());
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 0);
+
+    CHECK(library.release_books(uuids, Batch::ALL_OR_NOTHING).has_value());
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 3);
+
+    // A single failure leaves the whole batch uncommitted.
+    CHECK_EQ(library
+                 .acquire_books(std::array{uuids[0], missing},
+                                Batch::ALL_OR_NOTHING)
+                 .error(),
+             Error::INVALID_ARGUMENT);
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 3);
+    CHECK_FALSE(library.find(uuids[0])->acquired);
+
+    auto const erased = *library.erase_many(std::array{uuids[0], missing});
+    REQUIRE_EQ(erased.size(), 2);
+    CHECK(erased[0].has_value());
+    CHECK_EQ(erased[1].error(), Error::INVALID_ARGUMENT);
+    CHECK_EQ(*library.size(), 2);
+    CHECK(library.acquire_books({})->empty());
+  }
+
+  TEST_CASE("LibraryBatchWriteFailure") {
+    using Error = tb::Library::Error;
+    using Batch = tb::Library::Batch;
+
+    // Makes the database refuse to acquire or release copies of Siddhartha.
+    static constexpr auto REJECT_SQL = R"(
+      CREATE TRIGGER reject BEFORE UPDATE OF acquired ON copy
+      WHEN (SELECT name FROM book WHERE isbn = new.isbn) = 'Siddhartha'
+      BEGIN SELECT RAISE(ABORT, 'rejected'); END;
+    )";
+
+    TempDatabase db;
+    std::vector<tb::UUID> uuids;
+    {
+      auto library = *tb::make_library(db.path);
+      uuids = *library.insert_many(
+          std::array{BOOK_HAMLET, BOOK_SIDDHARTHA, BOOK_HAMLET});
+    }
+    {
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(db.path.c_str(), &raw), SQLITE_OK);
+      auto const rc =
+          sqlite3_exec(raw, REJECT_SQL, nullptr, nullptr, nullptr);
+      sqlite3_close(raw);
+      REQUIRE_EQ(rc, SQLITE_OK);
+    }
+
+    auto library = *tb::make_library(db.path, {.availability_index = true});
+    CHECK_EQ(library.acquire_books(uuids, Batch::ALL_OR_NOTHING).error(),
+             Error::UNEXPECTED);
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 2);
+
+    // Only the copy the database refused fails, and its flag is restored.
+    auto const acquired = *library.acquire_books(uuids, Batch::PER_ITEM);
+    REQUIRE_EQ(acquired.size(), 3);
+    CHECK(acquired[0].has_value());
+    CHECK_EQ(acquired[1].error(), Error::UNEXPECTED);
+    CHECK(acquired[2].has_value());
+    CHECK_EQ(*library.available_copies(BOOK_HAMLET.isbn), 0);
+    CHECK_FALSE(library.find(uuids[1])->acquired);
+    CHECK_EQ(library.acquire_book(uuids[1]).error(), Error::UNEXPECTED);
+  }
+
+  TEST_CASE("LibraryChanges") {
+    using Kind = tb::Library::ChangeKind;
+    auto library = *tb::make_library(":memory:");
+
+    std::vector<tb::Library::Change> pushed;
+    auto const subscription = *library.subscribe(
+        [&pushed](std::span<tb::Library::Change const> batch) {
+          pushed.insert(pushed.end(), batch.begin(), batch.end());
+        });
+    CHECK_EQ(subscription.sequence, 0);
+
+    auto const hamlet_uuid = *library.insert(BOOK_HAMLET);
+    auto const siddhartha_uuid = *library.insert(BOOK_SIDDHARTHA);
+    REQUIRE(library.acquire_book(hamlet_uuid).has_value());
+    REQUIRE(!library.acquire_book(hamlet_uuid).has_value());
+    REQUIRE(library.release_book(hamlet_uuid).has_value());
+    REQUIRE(library.erase(siddhartha_uuid).has_value());
+
+    auto const changes = *library.changes(0, 100);
+    REQUIRE_EQ(changes.size(), 5);
+    auto const kinds =
+        changes | std::views::transform(&tb::Library::Change::kind);
+    CHECK(std::ranges::equal(kinds, std::array{Kind::INSERT, Kind::INSERT,
+                                               Kind::ACQUIRE, Kind::RELEASE,
+                                               Kind::ERASE}));
+    CHECK_EQ(changes[2].uuid, hamlet_uuid);
+    CHECK_EQ(changes[4].uuid, siddhartha_uuid);
+    CHECK(std::ranges::is_sorted(changes, {}, &tb::Library::Change::sequence));
+
+    // Subscribers get the same changes as they commit.
+    REQUIRE_EQ(pushed.size(), changes.size());
+    CHECK_EQ(pushed.back().sequence, changes.back().sequence);
+
+    // Consumers pick up only the changes after the last one they applied.
+    auto const delta = *library.changes(changes[2].sequence, 1);
+    REQUIRE_EQ(delta.size(), 1);
+    CHECK_EQ(delta.front().kind, Kind::RELEASE);
+
+    library.unsubscribe(subscription.id);
+    REQUIRE(library.trim_changes(changes.back().sequence).has_value());
+    CHECK(library.changes(0, 100)->empty());
+
+    REQUIRE(library.insert(BOOK_HAMLET).has_value());
+    auto const after_trim = *library.changes(0, 100);
+    REQUIRE_EQ(after_trim.size(), 1);
+    CHECK_GT(after_trim.front().sequence, changes.back().sequence);
+    CHECK_EQ(pushed.size(), changes.size());
+  }
+
+  TEST_CASE("LibraryChangeRetention") {
+    auto library = *tb::make_library(":memory:", {.change_log_retention = 8});
+    for (int i = 0; i < 128; ++i) {
+      REQUIRE(library.insert(BOOK_HAMLET).has_value());
+    }
+
+    // Trimmed every 64 changes, so the log is down to the last 8 changes.
+    auto const changes = *library.changes(0, 1'000);
+    REQUIRE_EQ(changes.size(), 8);
+    CHECK_EQ(changes.front().sequence, 121);
+    CHECK_EQ(changes.back().sequence, 128);
+
+    REQUIRE(library.insert(BOOK_HAMLET).has_value());
+    CHECK_EQ(library.changes(0, 1'000)->size(), 9);
+
+    // One commit logging more than the interval is trimmed right after it.
+    std::vector<tb::Book> const books(200, BOOK_HAMLET);
+    REQUIRE(library.insert_many(books).has_value());
+    auto const after_batch = *library.changes(0, 1'000);
+    REQUIRE_EQ(after_batch.size(), 8);
+    CHECK_EQ(after_batch.back().sequence, 329);
+  }
+}
+
+TEST_SUITE("Import") {
+  // Writes `json` to a temporary file removed at scope exit.
+  struct TempJson {
+    std::string path = std::format(
+        "{}/amphlib-{}.json", std::filesystem::temp_directory_path().string(),
+        std::string_view(tb::UUIDString(tb::UUID{})));
+
+    explicit TempJson(std::string_view json) {
+      std::ofstream(path) << json;
+    }
+
+    TempJson(TempJson const&) = delete;
+    auto operator=(TempJson const&) -> TempJson& = delete;
+
+    ~TempJson() { std::filesystem::remove(path); }
+  };
+
+  TEST_CASE("ImportVolumes") {
+    auto library = *tb::make_library(":memory:");
+
+    SUBCASE("ApiResponse") {
+      TempJson json(R"({
+        "kind": "books#volumes",
+        "totalItems": 3,
+        "items": [
+          {
+            "id": "a",
+            "volumeInfo": {
+              "title": "Hamlet",
+              "authors": ["William Shakespeare"],
+              "pageCount": 342,
+              "industryIdentifiers": [
+                {"type": "ISBN_10", "identifier": "0000000000"},
+                {"type": "ISBN_13", "identifier": "9788027237142"}
+              ]
+            }
+          },
+          {
+            "id": "b",
+            "volumeInfo": {
+              "title": "Die Brüder \"Karamasow\"",
+              "authors": ["Fjodor", "Dostojewski"],
+              "industryIdentifiers": [
+                {"type": "ISBN_13", "identifier": "9781438279336"}
+              ]
+            }
+          },
+          {
+            "id": "c",
+            "volumeInfo": {"title": "No identifiers", "authors": ["Nobody"]}
+          }
+        ]
+      })");
+
+      auto summary = tb::import_json(library, json.path, {.batch_size = 1});
+      REQUIRE(summary.has_value());
+      CHECK_EQ(summary->imported, 2);
+      CHECK_EQ(summary->skipped, 1);
+      CHECK_EQ(*library.size(), 2);
+
+      auto records = *library.author_like("Fjodor, Dostojewski");
+      REQUIRE_EQ(records.size(), 1);
+      CHECK_EQ(records.front().name, "Die Brüder \"Karamasow\"");
+    }
+
+    SUBCASE("Array") {
+      // Every tenth volume retitles the book and is skipped.
+      std::string volumes = "[";
+      for (int i = 0; i < 100; ++i) {
+        volumes += std::format(
+            R"({}{{"title": "Hamlet{}", "authors": ["William Shakespeare"],)"
+            R"( "isbn": "9788027237142"}})",
+            i == 0 ? "" : ",", i % 10 == 9 ? std::format(" {}", i) : "");
+      }
+      volumes += "]";
+
+      TempJson json(volumes);
+      auto summary =
+          tb::import_json(library, json.path, {.threads = 4, .batch_size = 7});
+      REQUIRE(summary.has_value());
+      CHECK_EQ(summary->imported, 90);
+      CHECK_EQ(summary->skipped, 10);
+      CHECK_EQ(*library.size(), 90);
+      CHECK_EQ(*library.distinct(), 1);
+      CHECK_EQ(library.records()->front().name, "Hamlet");
+    }
+  }
+
+  TEST_CASE("ImportErrors") {
+    auto library = *tb::make_library(":memory:");
+
+    SUBCASE("MissingFile") {
+      CHECK_EQ(tb::import_json(library, "/nonexistent/amphlib.json").error(),
+               tb::ImportError::IO);
+    }
+
+    SUBCASE("Malformed") {
+      TempJson json(R"({"items": [{"title": "Hamlet"})");
+      CHECK_EQ(tb::import_json(library, json.path).error(),
+               tb::ImportError::MALFORMED_JSON);
+      CHECK_EQ(*library.size(), 0);
+    }
+  }
+}
+
+TEST_SUITE("Async") {
+  // Starts eagerly and finishes on whichever thread resumes it last.
+  struct Detached {
+    struct promise_type {
+      auto get_return_object() -> Detached { return {}; }
+      auto initial_suspend() -> std::suspend_never { return {}; }
+      auto final_suspend() noexcept -> std::suspend_never { return {}; }
+      auto return_void() -> void {}
+      auto unhandled_exception() -> void { std::terminate(); }
+    };
+  };
+
+  TEST_CASE("AsyncLibraryPipeline") {
+    tb::AsyncLibrary library(*tb::make_library(":memory:"));
+
+    // Queued back to back and run in order on the single executor thread.
+    auto hamlet = library.insert(BOOK_HAMLET);
+    auto siddhartha = library.insert(BOOK_SIDDHARTHA);
+    auto size = library.size();
+    auto shakespeare = library.author_like("Shakespeare");
+
+    REQUIRE(hamlet.get().has_value());
+    REQUIRE(siddhartha.get().has_value());
+    CHECK_EQ(*size.get(), 2);
+
+    auto records = shakespeare.get();
+    REQUIRE(records.has_value());
+    REQUIRE_EQ(records->size(), 1);
+    CHECK_EQ(records->front().name, BOOK_HAMLET.name);
+  }
+
+  TEST_CASE("AsyncLibraryCoroutine") {
+    struct Outcome {
+      std::expected<tb::UUID, tb::Library::Error> inserted;
+      std::expected<void, tb::Library::Error> acquired, acquired_twice,
+          released;
+      std::expected<tb::Library::Record, tb::Library::Error> found;
+    };
+
+    auto checkout = [](tb::AsyncLibrary& library,
+                       std::promise<Outcome> done) -> Detached {
+      Outcome outcome;
+      outcome.inserted = co_await library.insert(BOOK_HAMLET);
+      if (outcome.inserted.has_value()) {
+        auto const uuid = *outcome.inserted;
+        outcome.acquired = co_await library.acquire_book(uuid);
+        outcome.acquired_twice = co_await library.acquire_book(uuid);
+        outcome.found = co_await library.find(uuid);
+        outcome.released = co_await library.release_book(uuid);
+      }
+      done.set_value(std::move(outcome));
+    };
+
+    tb::AsyncLibrary library(*tb::make_library(":memory:"), {.threads = 2});
+    std::promise<Outcome> done;
+    auto outcome_future = done.get_future();
+    checkout(library, std::move(done));
+
+    auto const outcome = outcome_future.get();
+    REQUIRE(outcome.inserted.has_value());
+    CHECK(outcome.acquired.has_value());
+    CHECK_EQ(outcome.acquired_twice.error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    REQUIRE(outcome.found.has_value());
+    CHECK(outcome.found->acquired);
+    CHECK(outcome.released.has_value());
+  }
+}
+
+TEST_SUITE("Sharded") {
+  TEST_CASE("ShardedLibrary") {
+    auto library = *tb::make_sharded_library(":memory:", 4);
+    REQUIRE_EQ(library.shard_count(), 4);
+
+    std::vector<tb::Book> books(32, BOOK_SIDDHARTHA);
+    books.push_back(BOOK_HAMLET);
+    auto const uuids = *library.insert_many(books);
+    auto const hamlet_uuid = *library.insert(BOOK_HAMLET);
+
+    // Copies of one ISBN spread over several shards count as one book.
+    CHECK_EQ(*library.size(), 34);
+    CHECK_EQ(*library.distinct(), 2);
+    CHECK_EQ(library.records()->size(), 34);
+    CHECK_EQ(library.author_like("Shakespeare")->size(), 2);
+    CHECK_EQ(library.find(uuids.front())->name, BOOK_SIDDHARTHA.name);
+
+    for (std::size_t i = 0; i < 32; ++i) {
+      CHECK(library.acquire_any(BOOK_SIDDHARTHA.isbn).has_value());
+    }
+
+    CHECK_EQ(library.acquire_any(BOOK_SIDDHARTHA.isbn).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK_EQ(*library.available_copies(BOOK_SIDDHARTHA.isbn), 0);
+    CHECK(library.release_book(uuids.front()).has_value());
+    CHECK_EQ(*library.available_copies(BOOK_SIDDHARTHA.isbn), 1);
+
+    CHECK(library.erase(hamlet_uuid).has_value());
+    CHECK_EQ(library.find(hamlet_uuid).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK_EQ(*library.distinct(), 2);
+    CHECK(library.erase(uuids.back()).has_value());
+    CHECK_EQ(*library.distinct(), 1);
+
+    // Concurrent queries share the library's worker threads.
+    std::atomic<bool> failed = false;
+    {
+      std::vector<std::jthread> threads;
+      for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&library, &failed] {
+          for (int j = 0; j < 16; ++j) {
+            if (library.size() != std::size_t{32}) {
+              failed = true;
+            }
+          }
+        });
+      }
+    }
+    CHECK(!failed);
+  }
+
+  TEST_CASE("ShardedLibraryInsertManyFailure") {
+    // Shard 0 refuses to erase copies and shard 1 refuses to insert them.
+    static constexpr std::array SHARD_SQL = {
+        R"(CREATE TRIGGER keep BEFORE DELETE ON copy
+           BEGIN SELECT RAISE(ABORT, 'kept'); END;)",
+        R"(CREATE TRIGGER reject BEFORE INSERT ON copy
+           BEGIN SELECT RAISE(ABORT, 'rejected'); END;)",
+    };
+
+    TempDatabase db;
+    std::array<TempDatabase, 2> shard_files;
+    for (std::size_t i = 0; i < shard_files.size(); ++i) {
+      shard_files[i].path = std::format("{}.{}", db.path, i);
+    }
+
+    REQUIRE(tb::make_sharded_library(db.path, 2).has_value());
+    for (std::size_t i = 0; i < shard_files.size(); ++i) {
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(shard_files[i].path.c_str(), &raw), SQLITE_OK);
+      auto const rc =
+          sqlite3_exec(raw, SHARD_SQL[i], nullptr, nullptr, nullptr);
+      sqlite3_close(raw);
+      REQUIRE_EQ(rc, SQLITE_OK);
+    }
+
+    // The copies committed to shard 0 cannot be taken back and are named.
+    auto library = *tb::make_sharded_library(db.path, 2);
+    auto const result =
+        library.insert_many(std::vector<tb::Book>(32, BOOK_HAMLET));
+    REQUIRE(!result.has_value());
+    CHECK_EQ(result.error().error, tb::Library::Error::UNEXPECTED);
+    REQUIRE(!result.error().left_behind.empty());
+    CHECK_EQ(*library.size(), result.error().left_behind.size());
+    for (auto const& uuid : result.error().left_behind) {
+      CHECK(library.find(uuid).has_value());
+    }
+  }
+
+  TEST_CASE("ShardedLibraryRouting") {
+    static constexpr auto RECORD_SQL = R"(
+      CREATE TABLE record(
+        uuid TEXT PRIMARY KEY,
+        isbn TEXT NOT NULL,
+        name TEXT NOT NULL,
+        author TEXT NOT NULL,
+        acquired INTEGER DEFAULT 0
+      );
+      INSERT INTO record VALUES(
+        'd99d53e1-b67c-438b-8420-63766d8f50d0',
+        '9788027237142', 'Hamlet', 'William Shakespeare', 0
+      );
+    )";
+
+    TempDatabase db;
+    std::array<TempDatabase, 4> shard_files;
+    for (std::size_t i = 0; i < shard_files.size(); ++i) {
+      shard_files[i].path = std::format("{}.{}", db.path, i);
+    }
+
+    // The shard a UUID routes to is part of the on-disk format; this one
+    // has lived in shard 2 of 4 on every host and build.
+    {
+      sqlite3* raw;
+      REQUIRE_EQ(sqlite3_open(shard_files[2].path.c_str(), &raw), SQLITE_OK);
+      auto const rc = sqlite3_exec(raw, RECORD_SQL, nullptr, nullptr, nullptr);
+      sqlite3_close(raw);
+      REQUIRE_EQ(rc, SQLITE_OK);
+    }
+
+    auto library = *tb::make_sharded_library(db.path, 4);
+    auto const uuid = static_cast<tb::UUID>(
+        *tb::make_uuid_string("d99d53e1-b67c-438b-8420-63766d8f50d0"));
+    CHECK_EQ(library.find(uuid)->name, BOOK_HAMLET.name);
+  }
+}
+
+TEST_SUITE("Snapshot") {
+  TEST_CASE("SnapshotLibrary") {
+    auto library = *tb::make_library(":memory:");
+    auto const siddhartha_uuids =
+        *library.insert_many(std::vector<tb::Book>(3, BOOK_SIDDHARTHA));
+    auto const hamlet_uuid = *library.insert(BOOK_HAMLET);
+    REQUIRE(library.acquire_book(siddhartha_uuids.front()).has_value());
+
+    TempDatabase file;
+    REQUIRE(tb::write_snapshot(library, file.path).has_value());
+    auto snapshot = *tb::make_snapshot_library(file.path);
+
+    CHECK_EQ(snapshot.size(), 4);
+    CHECK_EQ(snapshot.distinct(), 2);
+    CHECK_EQ(snapshot.find(hamlet_uuid)->name, BOOK_HAMLET.name);
+    CHECK(snapshot.find(siddhartha_uuids.front())->acquired);
+    CHECK_EQ(snapshot.find(tb::UUID{}).error(),
+             tb::Library::Error::INVALID_ARGUMENT);
+    CHECK_EQ(*snapshot.available_copies(BOOK_SIDDHARTHA.isbn), 2);
+    CHECK_EQ(*snapshot.available_copies(BOOK_HAMLET.isbn), 1);
+
+    auto const expected = *library.records();
+    auto const records = *snapshot.records();
+    REQUIRE_EQ(records.size(), expected.size());
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      CHECK_EQ(records[i].uuid, expected[i].uuid);
+      CHECK_EQ(snapshot.view(i)->uuid, expected[i].uuid);
+    }
+
+    CHECK_EQ(snapshot.records(tb::Library::Order::NAME)->front().uuid,
+             hamlet_uuid);
+    CHECK_EQ(snapshot.author_like("hesse")->size(), 3);
+    CHECK_EQ(snapshot.name_like("")->size(), 4);
+
+    {
+      std::ofstream(file.path, std::ios::binary | std::ios::trunc)
+          << "not a snapshot";
+    }
+
+    CHECK_EQ(tb::make_snapshot_library(file.path).error(),
+             tb::SnapshotError::MALFORMED);
+    CHECK_EQ(tb::make_snapshot_library(file.path + ".missing").error(),
+             tb::SnapshotError::IO);
+  }
 }
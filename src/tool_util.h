@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "tbrekalo/library.h"
+
+namespace tbrekalo::tool {
+
+// On-disk database file removed together with its journal side files.
+struct TempDatabase {
+  std::string path;
+
+  // `tool` names the executable so concurrent runs of different tools don't
+  // collide in the temporary directory.
+  explicit TempDatabase(std::string_view tool)
+      : path(std::format("{}/amphlib-{}-{}.db",
+                         std::filesystem::temp_directory_path().string(), tool,
+                         std::string_view(UUIDString(UUID{})))) {}
+
+  TempDatabase(TempDatabase const&) = delete;
+  auto operator=(TempDatabase const&) -> TempDatabase& = delete;
+
+  ~TempDatabase() {
+    for (auto suffix : {"", "-wal", "-shm", "-journal"}) {
+      std::filesystem::remove(path + suffix);
+    }
+  }
+};
+
+[[noreturn]] inline auto fail(std::string_view message) -> void {
+  std::cerr << message << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+// Checksum-valid ISBN-13 digits, distinct for every index.
+inline auto make_isbn_digits(std::size_t index) -> std::string {
+  auto digits = std::format("978{:09}", index % 1'000'000'000);
+  int sum = 0;
+  for (std::size_t i = 0; i < digits.size(); ++i) {
+    sum += (digits[i] - '0') * (i % 2 == 0 ? 1 : 3);
+  }
+  digits.push_back(static_cast<char>('0' + (10 - sum % 10) % 10));
+  return digits;
+}
+
+}  // namespace tbrekalo::tool
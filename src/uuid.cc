@@ -2,29 +2,408 @@
 
 #include <uuid/uuid.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <mutex>
 
 namespace tbrekalo {
 
+static constexpr std::size_t UUID_BYTES = 16;
+static constexpr std::size_t UUID_CHARS = 36;
+
+// Offsets of the 32 hex digits within the string form, most significant
+// nibble first.
+static constexpr std::array<std::uint8_t, 2 * UUID_BYTES> HEX_OFFSETS = {
+    0,  1,  2,  3,  4,  5,  6,  7,  9,  10, 11, 12, 14, 15, 16, 17,
+    19, 20, 21, 22, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+};
+
+static constexpr std::array<std::uint8_t, 4> HYPHEN_OFFSETS = {8, 13, 18, 23};
+
+static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+static auto hex_value(char c) -> int {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+    return (c | 0x20) - 'a' + 10;
+  }
+  return -1;
+}
+
+static auto has_hyphens(char const* src) -> bool {
+  for (auto offset : HYPHEN_OFFSETS) {
+    if (src[offset] != '-') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static auto parse_uuid_scalar(char const* src, unsigned char* dst) -> bool {
+  if (!has_hyphens(src)) {
+    return false;
+  }
+
+  unsigned char bytes[UUID_BYTES];
+  for (std::size_t i = 0; i < UUID_BYTES; ++i) {
+    auto const hi = hex_value(src[HEX_OFFSETS[2 * i]]);
+    auto const lo = hex_value(src[HEX_OFFSETS[2 * i + 1]]);
+    if (hi < 0 || lo < 0) {
+      return false;
+    }
+    bytes[i] = static_cast<unsigned char>((hi << 4) | lo);
+  }
+
+  std::memcpy(dst, bytes, UUID_BYTES);
+  return true;
+}
+
+static auto serialize_uuid_scalar(unsigned char const* src, char* dst)
+    -> void {
+  for (std::size_t i = 0; i < UUID_BYTES; ++i) {
+    dst[HEX_OFFSETS[2 * i]] = HEX_DIGITS[src[i] >> 4];
+    dst[HEX_OFFSETS[2 * i + 1]] = HEX_DIGITS[src[i] & 0x0F];
+  }
+  for (auto offset : HYPHEN_OFFSETS) {
+    dst[offset] = '-';
+  }
+}
+
+#if defined(__x86_64__)
+
+// The string form is read and written as three overlapping 16-byte blocks at
+// offsets 0, 16 and 20, so no byte past the 36th is touched. Hex digits 0-15
+// live in the blocks at 0 and 16, digits 16-31 in the blocks at 16 and 20.
+// In shuffle masks -1 zeroes the byte.
+using ShuffleMask = std::array<std::int8_t, 16>;
+
+static constexpr ShuffleMask GATHER_LO_FROM_0 = {
+    0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 14, 15, -1, -1};
+static constexpr ShuffleMask GATHER_LO_FROM_16 = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1};
+static constexpr ShuffleMask GATHER_HI_FROM_16 = {
+    3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1};
+static constexpr ShuffleMask GATHER_HI_FROM_20 = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 12, 13, 14, 15};
+
+static constexpr ShuffleMask SCATTER_LO_TO_0 = {
+    0, 1, 2, 3, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12, 13};
+static constexpr ShuffleMask SCATTER_LO_TO_16 = {
+    14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+static constexpr ShuffleMask SCATTER_HI_TO_16 = {
+    -1, -1, -1, 0, 1, 2, 3, -1, 4, 5, 6, 7, 8, 9, 10, 11};
+static constexpr ShuffleMask SCATTER_HI_TO_20 = {
+    1, 2, 3, -1, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+static constexpr ShuffleMask HYPHENS_AT_0 = {
+    0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, 0, '-', 0, 0};
+static constexpr ShuffleMask HYPHENS_AT_16 = {
+    0, 0, '-', 0, 0, 0, 0, '-', 0, 0, 0, 0, 0, 0, 0, 0};
+static constexpr ShuffleMask HYPHENS_AT_20 = {
+    0, 0, 0, '-', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+static constexpr ShuffleMask HEX_TABLE = {'0', '1', '2', '3', '4', '5',
+                                          '6', '7', '8', '9', 'a', 'b',
+                                          'c', 'd', 'e', 'f'};
+
+[[gnu::target("sse4.1")]] static auto load(void const* src) -> __m128i {
+  return _mm_loadu_si128(static_cast<__m128i const*>(src));
+}
+
+[[gnu::target("sse4.1")]] static auto store(void* dst, __m128i value)
+    -> void {
+  _mm_storeu_si128(static_cast<__m128i*>(dst), value);
+}
+
+[[gnu::target("sse4.1")]] static auto shuffle(__m128i value,
+                                              ShuffleMask const& mask)
+    -> __m128i {
+  return _mm_shuffle_epi8(value, load(mask.data()));
+}
+
+// Lane 0 from `lo`, lane 1 from `hi`.
+[[gnu::target("avx2")]] static auto load(void const* lo, void const* hi)
+    -> __m256i {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(load(lo)), load(hi),
+                                 1);
+}
+
+[[gnu::target("avx2")]] static auto store(void* lo, void* hi, __m256i value)
+    -> void {
+  store(lo, _mm256_castsi256_si128(value));
+  store(hi, _mm256_extracti128_si256(value, 1));
+}
+
+// The same 16 bytes in both lanes.
+[[gnu::target("avx2")]] static auto broadcast(ShuffleMask const& mask)
+    -> __m256i {
+  return _mm256_broadcastsi128_si256(load(mask.data()));
+}
+
+[[gnu::target("avx2")]] static auto shuffle(__m256i value,
+                                            ShuffleMask const& mask)
+    -> __m256i {
+  return _mm256_shuffle_epi8(value, broadcast(mask));
+}
+
+// Maps '0'-'9', 'a'-'f' and 'A'-'F' to their values and clears the bytes of
+// `valid` holding any other character.
+[[gnu::target("sse4.1")]] static auto hex_to_nibbles(__m128i hex,
+                                                     __m128i& valid)
+    -> __m128i {
+  auto const digit = _mm_sub_epi8(hex, _mm_set1_epi8('0'));
+  auto const is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  auto const letter = _mm_sub_epi8(_mm_or_si128(hex, _mm_set1_epi8(0x20)),
+                                   _mm_set1_epi8('a'));
+  auto const is_letter =
+      _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  valid = _mm_and_si128(valid, _mm_or_si128(is_digit, is_letter));
+  return _mm_blendv_epi8(_mm_add_epi8(letter, _mm_set1_epi8(10)), digit,
+                         is_digit);
+}
+
+[[gnu::target("avx2")]] static auto hex_to_nibbles(__m256i hex,
+                                                   __m256i& valid)
+    -> __m256i {
+  auto const digit = _mm256_sub_epi8(hex, _mm256_set1_epi8('0'));
+  auto const is_digit =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+  auto const letter = _mm256_sub_epi8(
+      _mm256_or_si256(hex, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+  auto const is_letter =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+  valid = _mm256_and_si256(valid, _mm256_or_si256(is_digit, is_letter));
+  return _mm256_blendv_epi8(_mm256_add_epi8(letter, _mm256_set1_epi8(10)),
+                            digit, is_digit);
+}
+
+[[gnu::target("sse4.1")]] static auto parse_uuid_sse4(char const* src,
+                                                      unsigned char* dst)
+    -> bool {
+  auto const block_0 = load(src);
+  auto const block_16 = load(src + 16);
+  auto const block_20 = load(src + 20);
+
+  auto valid = _mm_set1_epi8(-1);
+  auto const lo = hex_to_nibbles(
+      _mm_or_si128(shuffle(block_0, GATHER_LO_FROM_0),
+                   shuffle(block_16, GATHER_LO_FROM_16)),
+      valid);
+  auto const hi = hex_to_nibbles(
+      _mm_or_si128(shuffle(block_16, GATHER_HI_FROM_16),
+                   shuffle(block_20, GATHER_HI_FROM_20)),
+      valid);
+  if (_mm_movemask_epi8(valid) != 0xFFFF || !has_hyphens(src)) {
+    return false;
+  }
+
+  // Every byte is its high nibble times 16 plus its low nibble.
+  auto const weights = _mm_set1_epi16(0x0110);
+  store(dst, _mm_packus_epi16(_mm_maddubs_epi16(lo, weights),
+                              _mm_maddubs_epi16(hi, weights)));
+  return true;
+}
+
+// Parses two UUIDs, one per lane, and stores both only if both are valid.
+[[gnu::target("avx2")]] static auto parse_uuid_pair_avx2(
+    char const* src_a, char const* src_b, unsigned char* dst_a,
+    unsigned char* dst_b) -> bool {
+  auto const block_0 = load(src_a, src_b);
+  auto const block_16 = load(src_a + 16, src_b + 16);
+  auto const block_20 = load(src_a + 20, src_b + 20);
+
+  auto valid = _mm256_set1_epi8(-1);
+  auto const lo = hex_to_nibbles(
+      _mm256_or_si256(shuffle(block_0, GATHER_LO_FROM_0),
+                      shuffle(block_16, GATHER_LO_FROM_16)),
+      valid);
+  auto const hi = hex_to_nibbles(
+      _mm256_or_si256(shuffle(block_16, GATHER_HI_FROM_16),
+                      shuffle(block_20, GATHER_HI_FROM_20)),
+      valid);
+  if (_mm256_movemask_epi8(valid) != -1 || !has_hyphens(src_a) ||
+      !has_hyphens(src_b)) {
+    return false;
+  }
+
+  auto const weights = _mm256_set1_epi16(0x0110);
+  store(dst_a, dst_b,
+        _mm256_packus_epi16(_mm256_maddubs_epi16(lo, weights),
+                            _mm256_maddubs_epi16(hi, weights)));
+  return true;
+}
+
+[[gnu::target("sse4.1")]] static auto serialize_uuid_sse4(
+    unsigned char const* src, char* dst) -> void {
+  auto const bytes = load(src);
+  auto const nibble = _mm_set1_epi8(0x0F);
+  auto const high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+  auto const low = _mm_and_si128(bytes, nibble);
+  auto const table = load(HEX_TABLE.data());
+  auto const lo = _mm_shuffle_epi8(table, _mm_unpacklo_epi8(high, low));
+  auto const hi = _mm_shuffle_epi8(table, _mm_unpackhi_epi8(high, low));
+
+  store(dst, _mm_or_si128(shuffle(lo, SCATTER_LO_TO_0),
+                          load(HYPHENS_AT_0.data())));
+  store(dst + 16, _mm_or_si128(_mm_or_si128(shuffle(lo, SCATTER_LO_TO_16),
+                                            shuffle(hi, SCATTER_HI_TO_16)),
+                               load(HYPHENS_AT_16.data())));
+  store(dst + 20, _mm_or_si128(shuffle(hi, SCATTER_HI_TO_20),
+                               load(HYPHENS_AT_20.data())));
+}
+
+[[gnu::target("avx2")]] static auto serialize_uuid_pair_avx2(
+    unsigned char const* src_a, unsigned char const* src_b, char* dst_a,
+    char* dst_b) -> void {
+  auto const bytes = load(src_a, src_b);
+  auto const nibble = _mm256_set1_epi8(0x0F);
+  auto const high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+  auto const low = _mm256_and_si256(bytes, nibble);
+  auto const table = broadcast(HEX_TABLE);
+  auto const lo = _mm256_shuffle_epi8(table, _mm256_unpacklo_epi8(high, low));
+  auto const hi = _mm256_shuffle_epi8(table, _mm256_unpackhi_epi8(high, low));
+
+  store(dst_a, dst_b,
+        _mm256_or_si256(shuffle(lo, SCATTER_LO_TO_0), broadcast(HYPHENS_AT_0)));
+  store(dst_a + 16, dst_b + 16,
+        _mm256_or_si256(_mm256_or_si256(shuffle(lo, SCATTER_LO_TO_16),
+                                        shuffle(hi, SCATTER_HI_TO_16)),
+                        broadcast(HYPHENS_AT_16)));
+  store(dst_a + 20, dst_b + 20,
+        _mm256_or_si256(shuffle(hi, SCATTER_HI_TO_20),
+                        broadcast(HYPHENS_AT_20)));
+}
+
+#endif
+
+enum class Kernel : char { SCALAR, SSE4, AVX2 };
+
+// Widest kernel the CPU supports, detected on first use.
+static auto kernel() -> Kernel {
+  static Kernel const detected = [] {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return Kernel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return Kernel::SSE4;
+    }
+#endif
+    return Kernel::SCALAR;
+  }();
+  return detected;
+}
+
+// Parses the 36 characters at `src` into the 16 bytes at `dst`, leaving `dst`
+// untouched on failure.
+static auto parse_uuid(char const* src, unsigned char* dst) -> bool {
+#if defined(__x86_64__)
+  if (kernel() != Kernel::SCALAR) {
+    return parse_uuid_sse4(src, dst);
+  }
+#endif
+  return parse_uuid_scalar(src, dst);
+}
+
+static auto serialize_uuid(unsigned char const* src, char* dst) -> void {
+#if defined(__x86_64__)
+  if (kernel() != Kernel::SCALAR) {
+    return serialize_uuid_sse4(src, dst);
+  }
+#endif
+  serialize_uuid_scalar(src, dst);
+}
+
 UUID::UUID() { uuid_generate(data_); }
 
-UUID::UUID(std::span<unsigned char, SIZE> source) {
+UUID::UUID(SourceSpan source) {
   std::memcpy(&data_, source.data(), SIZE);
 }
 
 auto UUID::serialize(std::span<char, UUID::TARGET_SIZE> target) const -> void {
-  uuid_unparse(data_, target.data());
+  serialize_uuid(data_, target.data());
+  target[UUID_CHARS] = '\0';
+}
+
+auto make_uuid_v7() -> UUID {
+  // Counter in the 12 rand_a bits (RFC 9562, section 6.2, method 1) keeps
+  // identifiers generated within the same millisecond ordered. It restarts
+  // from a random value below 0x800 every millisecond to leave headroom; on
+  // overflow the timestamp is advanced instead.
+  static constexpr std::uint16_t COUNTER_MAX = 0x0FFF;
+  static std::mutex mutex;
+  static std::uint64_t last_ms = 0;
+  static std::uint16_t counter = 0;
+
+  uuid_t bytes;
+  uuid_generate_random(bytes);
+
+  auto const now_ms = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+
+  std::uint64_t timestamp;
+  std::uint16_t sequence;
+  {
+    std::lock_guard lk(mutex);
+    if (now_ms > last_ms) {
+      last_ms = now_ms;
+      counter = static_cast<std::uint16_t>(((bytes[6] << 8) | bytes[7]) &
+                                           (COUNTER_MAX >> 1));
+    } else if (counter == COUNTER_MAX) {
+      ++last_ms;
+      counter = 0;
+    } else {
+      ++counter;
+    }
+
+    timestamp = last_ms;
+    sequence = counter;
+  }
+
+  for (int i = 0; i < 6; ++i) {
+    bytes[i] = static_cast<unsigned char>(timestamp >> (8 * (5 - i)));
+  }
+
+  bytes[6] = static_cast<unsigned char>(0x70 | (sequence >> 8));
+  bytes[7] = static_cast<unsigned char>(sequence);
+  bytes[8] = static_cast<unsigned char>(0x80 | (bytes[8] & 0x3F));
+  return UUID(bytes);
+}
+
+auto make_uuid(UUIDVersion version) -> UUID {
+  switch (version) {
+    case UUIDVersion::V4:
+      return UUID{};
+    case UUIDVersion::V7:
+      return make_uuid_v7();
+  }
+
+  std::unreachable();
 }
 
 UUIDString::UUIDString(std::string_view source) {
   assert(source.size() == STRING_LENGTH);
-  std::memcpy(data_, source.data(), UUID::TARGET_SIZE);
+  std::memcpy(data_, source.data(), STRING_LENGTH);
+  data_[STRING_LENGTH] = '\0';
 }
 
 auto make_uuid_string(std::string_view source) -> std::optional<UUIDString> {
-  // TODO(tbrekalo): do better checks on UUID?
-  if (source.size() != UUIDString::STRING_LENGTH) {
+  unsigned char bytes[UUID_BYTES];
+  if (source.size() != UUIDString::STRING_LENGTH ||
+      !parse_uuid(source.data(), bytes)) {
     return std::nullopt;
   }
 
@@ -32,9 +411,55 @@ auto make_uuid_string(std::string_view source) -> std::optional<UUIDString> {
 }
 
 UUIDString::operator UUID() const {
-  uuid_t uuid;
-  uuid_parse(data_, uuid);
-  return UUID(uuid);
+  unsigned char bytes[UUID_BYTES] = {};
+  parse_uuid(data_, bytes);
+  return UUID(bytes);
+}
+
+auto parse_uuids(std::span<std::string_view const> sources,
+                 std::span<UUID> targets) -> std::size_t {
+  assert(targets.size() >= sources.size());
+  std::size_t i = 0;
+#if defined(__x86_64__)
+  if (kernel() == Kernel::AVX2) {
+    for (; i + 1 < sources.size(); i += 2) {
+      if (sources[i].size() != UUID_CHARS ||
+          sources[i + 1].size() != UUID_CHARS ||
+          !parse_uuid_pair_avx2(sources[i].data(), sources[i + 1].data(),
+                                targets[i].data(), targets[i + 1].data())) {
+        break;
+      }
+    }
+  }
+#endif
+
+  // Tail, and the pair that failed so the malformed string is pinned down.
+  for (; i < sources.size(); ++i) {
+    if (sources[i].size() != UUID_CHARS ||
+        !parse_uuid(sources[i].data(), targets[i].data())) {
+      break;
+    }
+  }
+  return i;
+}
+
+auto serialize_uuids(std::span<UUID const> uuids, std::span<char> target)
+    -> void {
+  assert(target.size() >= UUID_CHARS * uuids.size());
+  std::size_t i = 0;
+#if defined(__x86_64__)
+  if (kernel() == Kernel::AVX2) {
+    for (; i + 1 < uuids.size(); i += 2) {
+      serialize_uuid_pair_avx2(uuids[i].data(), uuids[i + 1].data(),
+                               target.data() + UUID_CHARS * i,
+                               target.data() + UUID_CHARS * (i + 1));
+    }
+  }
+#endif
+
+  for (; i < uuids.size(); ++i) {
+    serialize_uuid(uuids[i].data(), target.data() + UUID_CHARS * i);
+  }
 }
 
 }  // namespace tbrekalo
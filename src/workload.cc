@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tbrekalo/library.h"
+#include "tool_util.h"
+
+namespace tb = tbrekalo;
+
+namespace {
+
+using tb::tool::fail;
+using tb::tool::make_isbn_digits;
+using tb::tool::TempDatabase;
+
+struct Options {
+  std::size_t threads = 8;
+  // Operations issued by every thread.
+  std::size_t ops = 10'000;
+  // Fraction of operations that search; the rest acquire or release.
+  double read_ratio = 0.8;
+  std::size_t catalog = 100'000;
+  // Zipf exponent of book popularity; zero picks books uniformly.
+  double skew = 0.99;
+  std::size_t read_connections = 0;
+  std::optional<tb::Library::Durability> availability;
+  bool memory = false;
+  bool json = false;
+};
+
+// Samples book ranks in [0, n) with P(k) proportional to 1 / (k + 1)^s.
+class ZipfDistribution {
+  std::vector<double> cdf_;
+
+ public:
+  ZipfDistribution(std::size_t n, double s) : cdf_(n) {
+    double sum = 0;
+    for (std::size_t k = 0; k < n; ++k) {
+      sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+      cdf_[k] = sum;
+    }
+
+    for (auto& p : cdf_) {
+      p /= sum;
+    }
+  }
+
+  template <class Rng>
+  auto operator()(Rng& rng) const -> std::size_t {
+    auto const u = std::uniform_real_distribution<double>(0, 1)(rng);
+    auto const it = std::ranges::lower_bound(cdf_, u);
+    return std::min<std::size_t>(it - cdf_.begin(), cdf_.size() - 1);
+  }
+};
+
+enum class Operation : char { ACQUIRE, RELEASE, SEARCH };
+
+static constexpr std::size_t OPERATION_COUNT = 3;
+
+static constexpr auto operation_name(Operation operation) -> std::string_view {
+  switch (operation) {
+    case Operation::ACQUIRE:
+      return "acquire_book";
+    case Operation::RELEASE:
+      return "release_book";
+    case Operation::SEARCH:
+      return "name_like";
+  }
+
+  std::unreachable();
+}
+
+// Per-thread latencies in nanoseconds, merged once all threads finish.
+struct Samples {
+  std::array<std::vector<std::uint64_t>, OPERATION_COUNT> latencies;
+  // Acquisitions of a book already held by another thread.
+  std::size_t conflicts = 0;
+
+  auto record(Operation operation, std::chrono::steady_clock::duration elapsed)
+      -> void {
+    latencies[static_cast<std::size_t>(operation)].push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+};
+
+// Books held by one thread at most; reaching it forces a release.
+static constexpr std::size_t MAX_HELD = 8;
+
+auto run_client(tb::Library& library, std::span<tb::UUID const> books,
+                ZipfDistribution const& zipf, Options const& options,
+                std::size_t seed) -> Samples {
+  std::mt19937_64 rng(seed);
+  std::bernoulli_distribution search(options.read_ratio);
+  std::bernoulli_distribution release(0.5);
+  std::deque<tb::UUID> held;
+  Samples samples;
+
+  for (std::size_t i = 0; i < options.ops; ++i) {
+    auto const start = std::chrono::steady_clock::now();
+    if (search(rng)) {
+      auto const pattern = std::format("Title {}", zipf(rng));
+      if (!library.name_like(pattern).has_value()) {
+        fail("name_like failed");
+      }
+      samples.record(Operation::SEARCH,
+                     std::chrono::steady_clock::now() - start);
+    } else if (!held.empty() && (held.size() == MAX_HELD || release(rng))) {
+      if (!library.release_book(held.front()).has_value()) {
+        fail("release_book failed");
+      }
+      held.pop_front();
+      samples.record(Operation::RELEASE,
+                     std::chrono::steady_clock::now() - start);
+    } else {
+      auto const uuid = books[zipf(rng)];
+      if (library.acquire_book(uuid).has_value()) {
+        held.push_back(uuid);
+      } else {
+        ++samples.conflicts;
+      }
+      samples.record(Operation::ACQUIRE,
+                     std::chrono::steady_clock::now() - start);
+    }
+  }
+
+  for (auto const& uuid : held) {
+    library.release_book(uuid);
+  }
+
+  return samples;
+}
+
+auto percentile(std::span<std::uint64_t const> sorted, double p)
+    -> std::uint64_t {
+  if (sorted.empty()) {
+    return 0;
+  }
+
+  auto const rank = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+auto parse_options(int argc, char** argv) -> Options {
+  Options options;
+  for (std::string_view arg : std::span(argv, argc).subspan(1)) {
+    auto const value =
+        std::string(arg.substr(std::min(arg.find('='), arg.size() - 1) + 1));
+    if (arg == "--json") {
+      options.json = true;
+    } else if (arg == "--memory") {
+      options.memory = true;
+    } else if (arg.starts_with("--threads=")) {
+      options.threads = std::stoull(value);
+    } else if (arg.starts_with("--ops=")) {
+      options.ops = std::stoull(value);
+    } else if (arg.starts_with("--read-ratio=")) {
+      options.read_ratio = std::clamp(std::stod(value), 0.0, 1.0);
+    } else if (arg.starts_with("--catalog=")) {
+      options.catalog = std::max<std::size_t>(std::stoull(value), 1);
+    } else if (arg.starts_with("--skew=")) {
+      options.skew = std::stod(value);
+    } else if (arg.starts_with("--read-connections=")) {
+      options.read_connections = std::stoull(value);
+    } else if (arg == "--availability=sync") {
+      options.availability = tb::Library::Durability::SYNC;
+    } else if (arg == "--availability=deferred") {
+      options.availability = tb::Library::Durability::DEFERRED;
+    } else {
+      fail(std::format(
+          "usage: {} [--threads=N] [--ops=N] [--read-ratio=F] [--catalog=N] "
+          "[--skew=F] [--read-connections=N] [--availability=sync|deferred] "
+          "[--memory] [--json]",
+          argv[0]));
+    }
+  }
+
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  static constexpr std::size_t BATCH_SIZE = 1'000;
+
+  auto const options = parse_options(argc, argv);
+
+  TempDatabase db("workload");
+  auto library = tb::make_library(
+      options.memory ? std::string_view(":memory:") : std::string_view(db.path),
+      {
+          .wal = !options.memory,
+          .read_connections = options.read_connections,
+          .availability_index = options.availability.has_value(),
+          .durability =
+              options.availability.value_or(tb::Library::Durability::SYNC),
+      });
+  if (!library.has_value()) {
+    fail("failed to open library");
+  }
+
+  std::vector<tb::UUID> books;
+  books.reserve(options.catalog);
+  for (std::size_t i = 0; i < options.catalog; i += BATCH_SIZE) {
+    std::vector<tb::Book> batch;
+    for (std::size_t j = i; j < std::min(i + BATCH_SIZE, options.catalog);
+         ++j) {
+      batch.push_back(tb::Book{
+          .isbn = *tb::make_isbn(make_isbn_digits(j)),
+          .name = std::format("Title {}", j),
+          .author = std::format("Author {}", j % 1'000),
+      });
+    }
+
+    auto uuids = library->insert_many(batch);
+    if (!uuids.has_value()) {
+      fail("failed to populate library");
+    }
+    books.insert(books.end(), uuids->begin(), uuids->end());
+  }
+
+  ZipfDistribution const zipf(options.catalog, options.skew);
+  std::vector<Samples> samples(options.threads);
+  auto const start = std::chrono::steady_clock::now();
+  {
+    std::vector<std::jthread> clients;
+    for (std::size_t i = 0; i < options.threads; ++i) {
+      clients.emplace_back([&, i] {
+        samples[i] = run_client(*library, books, zipf, options, i);
+      });
+    }
+  }
+  auto const seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  std::size_t conflicts = 0;
+  for (auto const& thread_samples : samples) {
+    conflicts += thread_samples.conflicts;
+  }
+
+  if (options.json) {
+    std::cout << std::format(
+        "{{\"threads\": {}, \"ops\": {}, \"read_ratio\": {}, \"catalog\": {}, "
+        "\"skew\": {}, \"seconds\": {:.6f}, \"conflicts\": {}, "
+        "\"operations\": [",
+        options.threads, options.ops, options.read_ratio, options.catalog,
+        options.skew, seconds, conflicts);
+  } else {
+    std::cout << std::format(
+        "{} threads, {} ops each, read ratio {}, catalog {}, skew {}\n"
+        "{:<14} {:>10} {:>14} {:>10} {:>10} {:>10}\n",
+        options.threads, options.ops, options.read_ratio, options.catalog,
+        options.skew, "operation", "count", "ops/s", "p50 us", "p99 us",
+        "p999 us");
+  }
+
+  for (std::size_t op = 0; op < OPERATION_COUNT; ++op) {
+    std::vector<std::uint64_t> latencies;
+    for (auto const& thread_samples : samples) {
+      latencies.insert(latencies.end(), thread_samples.latencies[op].begin(),
+                       thread_samples.latencies[op].end());
+    }
+    std::ranges::sort(latencies);
+
+    auto const name = operation_name(static_cast<Operation>(op));
+    auto const p50 = percentile(latencies, 0.5) / 1e3;
+    auto const p99 = percentile(latencies, 0.99) / 1e3;
+    auto const p999 = percentile(latencies, 0.999) / 1e3;
+    if (options.json) {
+      std::cout << std::format(
+          "{}{{\"name\": \"{}\", \"count\": {}, \"ops_per_second\": {:.3f}, "
+          "\"p50_us\": {:.3f}, \"p99_us\": {:.3f}, \"p999_us\": {:.3f}}}",
+          op == 0 ? "" : ", ", name, latencies.size(),
+          latencies.size() / seconds, p50, p99, p999);
+    } else {
+      std::cout << std::format("{:<14} {:>10} {:>14.0f} {:>10.1f} {:>10.1f} "
+                               "{:>10.1f}\n",
+                               name, latencies.size(),
+                               latencies.size() / seconds, p50, p99, p999);
+    }
+  }
+
+  if (options.json) {
+    std::cout << "]}\n";
+  } else {
+    std::cout << std::format("{:.0f} ops/s overall, {} acquire conflicts\n",
+                             options.threads * options.ops / seconds,
+                             conflicts);
+  }
+
+  return EXIT_SUCCESS;
+}